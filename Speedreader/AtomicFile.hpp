@@ -0,0 +1,35 @@
+#pragma once
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#include <string>
+#include <Siv3D.hpp>
+
+// 書き込み途中のファイルを読む側に見せないよう、一時ファイルに書いてから置き換える
+namespace atomicfile
+{
+	// 別のプロセスが同じファイルを書いていてもぶつからないよう、プロセスIDを付ける。拡張子は元のまま(Image::save が形式を決めるため)
+	FilePath tempPath(const FilePath& path) {
+		const std::wstring& s = path.str();
+		const size_t dot = s.rfind(L'.');
+		const size_t slash = s.find_last_of(L"/\\");
+		const FilePath ext = dot != std::wstring::npos && (slash == std::wstring::npos || dot > slash) ? FilePath(s.substr(dot)) : FilePath();
+		return Format(path, L".", GetCurrentProcessId(), L".tmp", ext);
+	}
+
+	// write(tmp) で一時ファイルに書き、書けたら path に置き換える
+	template <class Write>
+	bool write(const FilePath& path, Write write) {
+		const FilePath tmp = tempPath(path);
+		if (!write(tmp)) {
+			FileSystem::Remove(tmp);
+			return false;
+		}
+		return MoveFileExW(tmp.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+	}
+
+	bool save(const Image& image, const FilePath& path) {
+		return write(path, [&image](const FilePath& tmp) { return image.save(tmp); });
+	}
+}
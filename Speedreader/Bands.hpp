@@ -0,0 +1,124 @@
+#pragma once
+#include <ppltasks.h>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <Siv3D.hpp>
+#include "AtomicFile.hpp"
+
+// 大きなページを横帯(band)に分けて別々のPNGにしておき、帯ごとに並列でデコードする
+// 1枚のPNGは圧縮ストリームが1本なので1スレッドでしかデコードできない。
+// 600dpiのスキャンのような大きなページは、最初に読んだときに bands/ へ帯に分けて書き出し、
+// 次からは帯を全コアでデコードして1枚に貼り合わせる。
+// 帯も帯の数を書いたファイルも一時ファイルに書いてから置き換えるので、読む側が書きかけのファイルを見ることはない。
+// 背景での書き出しは1枚ごとに原寸の画像を持つので、同時に書き出す枚数に上限を設け、同じページは二重に書き出さない。
+namespace bands
+{
+	s3d::PyFmtString bandFmt = L"{}bands/page-{:03d}-{}.png"_fmt;
+	s3d::PyFmtString markerFmt = L"{}bands/page-{:03d}.txt"_fmt;
+	int32 minPixels = 2000 * 2000; // これより小さいページは分けない
+	int32 minBandHeight = 256;
+	bool writeOnDecode = true;
+	size_t maxPendingWrites = 2;   // 背景で同時に書き出すページ数の上限
+
+	namespace detail
+	{
+		std::mutex mutex;
+		std::set<std::wstring> writing; // 背景で書き出し中のページ(帯の数を書くファイルのパス)
+		Array<concurrency::task<void>> tasks;
+	}
+
+	// 帯の数を書いたファイル。帯を全部書き終えてから作るので、途中で落ちても半端な帯は使われない
+	int32 numBands(const FilePath& doc, int page) {
+		TextReader reader(Format(markerFmt, doc, page + 1));
+		if (!reader) return 0;
+		String line;
+		reader.readLine(line);
+		return Parse<int32>(line);
+	}
+
+	int32 bandsFor(int32 width, int32 height) {
+		if (width * height < minPixels) return 0;
+		const int32 cores = static_cast<int32>(std::thread::hardware_concurrency());
+		return std::max(1, std::min(cores, height / minBandHeight));
+	}
+
+	// 帯をすべて書き終えてから帯の数を書く。失敗した帯があれば帯の数は書かない
+	bool write(const Image& image, const FilePath& doc, int page, int32 n) {
+		FileSystem::CreateDirectories(Format(L"{}bands/"_fmt, doc));
+		const int32 bandHeight = (image.height + n - 1) / n;
+		std::atomic<bool> ok{ true };
+		concurrency::parallel_for(0, n, [&](int32 k) {
+			const int32 y = k * bandHeight;
+			const int32 h = std::min(bandHeight, image.height - y);
+			const FilePath path = Format(bandFmt, doc, page + 1, k);
+			if (!atomicfile::save(image.clipped(0, y, image.width, h), path)) {
+				ok = false;
+			}
+		});
+		if (!ok) return false;
+		return atomicfile::write(Format(markerFmt, doc, page + 1), [n](const FilePath& tmp) {
+			TextWriter writer(tmp);
+			if (!writer) return false;
+			writer.writeln(n);
+			return true;
+		});
+	}
+
+	// 初めてデコードしたページの帯を背景で書き出す。
+	// 同じページをすでに書き出し中か、maxPendingWrites 枚書き出し中なら何もしない(次にデコードしたときにまた試す)
+	void writeAsync(const Image& image, const FilePath& doc, int page, int32 n) {
+		const std::wstring key = Format(markerFmt, doc, page + 1).str();
+		{
+			std::lock_guard<std::mutex> lock(detail::mutex);
+			if (detail::writing.count(key) || detail::writing.size() >= maxPendingWrites) return;
+			detail::writing.insert(key);
+		}
+		auto copy = std::make_shared<Image>(image);
+		auto task = concurrency::create_task([copy, doc, page, n, key]() {
+			write(*copy, doc, page, n);
+			std::lock_guard<std::mutex> lock(detail::mutex);
+			detail::writing.erase(key);
+		});
+		std::lock_guard<std::mutex> lock(detail::mutex);
+		detail::tasks.erase(std::remove_if(detail::tasks.begin(), detail::tasks.end(),
+			[](const concurrency::task<void>& t) { return t.is_done(); }), detail::tasks.end());
+		detail::tasks.push_back(task);
+	}
+
+	// 終了時に呼ぶ。背景の書き出しを待つ
+	void waitWrites() {
+		Array<concurrency::task<void>> tasks;
+		{
+			std::lock_guard<std::mutex> lock(detail::mutex);
+			tasks.swap(detail::tasks);
+		}
+		for (auto& t : tasks) {
+			t.wait();
+		}
+	}
+
+	Image decode(const FilePath& doc, int page, int32 n) {
+		Array<Image> parts(n);
+		concurrency::parallel_for(0, n, [&](int32 k) {
+			parts[k] = Image(Format(bandFmt, doc, page + 1, k));
+		});
+		int32 height = 0;
+		for (const auto& part : parts) {
+			if (!part || part.width != parts[0].width) return Image();
+			height += part.height;
+		}
+		Image image(parts[0].width, height);
+		int32 y = 0;
+		for (const auto& part : parts) {
+			std::memcpy(image[y], part.data(), part.width * part.height * sizeof(Color));
+			y += part.height;
+		}
+		return image;
+	}
+}
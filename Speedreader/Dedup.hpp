@@ -0,0 +1,147 @@
+#pragma once
+#include <ppl.h>
+#include <algorithm>
+#include <unordered_map>
+#include <Siv3D.hpp>
+#include "AtomicFile.hpp"
+
+// 同じ内容のページ(白紙の裏、章の区切り、繰り返しの図版)を見つけて1枚にまとめる
+// ページごとに代表ページの番号(canonical)を決め、loader は代表ページだけをデコードしてTextureを共有する。
+// 取り込み時に dedup.ini を書いておけばそれを使い、なければ開いたときに背景でファイルの中身のハッシュを取って dedup.ini に書く。
+namespace dedup
+{
+	s3d::PyFmtString keyFmt = L"page{:03d}"_fmt;
+
+	// FNV-1a 64bit
+	uint64 hashBytes(const uint8* data, size_t size, uint64 h = 14695981039346656037ull) {
+		for (size_t i = 0; i < size; i++) {
+			h ^= data[i];
+			h *= 1099511628211ull;
+		}
+		return h;
+	}
+
+	uint64 hashFile(const FilePath& path) {
+		BinaryReader reader(path);
+		if (!reader) return 0;
+		uint8 buffer[64 * 1024];
+		uint64 h = 14695981039346656037ull;
+		while (true) {
+			const int64 n = reader.read(buffer, sizeof(buffer));
+			if (n <= 0) break;
+			h = hashBytes(buffer, static_cast<size_t>(n), h);
+		}
+		return h;
+	}
+
+	// 知覚ハッシュ(dHash)。9x8に縮めたグレースケールで隣どうしの明るさの大小を64bitに並べる
+	uint64 perceptualHash(const Image& image) {
+		const Image small = image.scaled(9, 8);
+		uint64 h = 0;
+		for (int32 y = 0; y < 8; y++) {
+			for (int32 x = 0; x < 8; x++) {
+				const Color a = small[y][x], b = small[y][x + 1];
+				const int32 la = a.r * 299 + a.g * 587 + a.b * 114;
+				const int32 lb = b.r * 299 + b.g * 587 + b.b * 114;
+				h = (h << 1) | (la > lb ? 1 : 0);
+			}
+		}
+		return h;
+	}
+
+	int32 hammingDistance(uint64 a, uint64 b) {
+		uint64 x = a ^ b;
+		int32 n = 0;
+		while (x) {
+			x &= x - 1;
+			n++;
+		}
+		return n;
+	}
+
+	// 同じハッシュのページは最初に出てきたページを代表にする
+	Array<int32> canonicalFromHashes(const Array<uint64>& hashes) {
+		Array<int32> canonical(hashes.size());
+		std::unordered_map<uint64, int32> first;
+		for (size_t i = 0; i < hashes.size(); i++) {
+			canonical[i] = static_cast<int32>(i);
+			if (hashes[i] == 0) continue; // 読めなかったページはまとめない
+			auto found = first.find(hashes[i]);
+			if (found != first.end()) {
+				canonical[i] = found->second;
+			}
+			else {
+				first[hashes[i]] = static_cast<int32>(i);
+			}
+		}
+		return canonical;
+	}
+
+	// ファイルの中身が完全に同じページ。全ページを並列にハッシュする
+	// allRead には全ページを読めたかを返す。読めなかったページがあれば結果は書き残さない
+	Array<int32> findExactDuplicates(const FilePath& doc, uint32 numPages, const s3d::PyFmtString& fmt, bool* allRead = nullptr) {
+		Array<uint64> hashes(numPages);
+		concurrency::parallel_for(0u, numPages, [&](uint32 i) {
+			hashes[i] = hashFile(Format(fmt, doc, i + 1));
+		});
+		if (allRead) {
+			*allRead = std::find(hashes.begin(), hashes.end(), 0ull) == hashes.end();
+		}
+		return canonicalFromHashes(hashes);
+	}
+
+	// 見た目がほぼ同じページもまとめる。大きさが同じで、dHashの差が threshold bit 以下のもの
+	void mergePerceptual(Array<int32>& canonical, const Array<uint64>& phashes, const Array<Size>& sizes, int32 threshold) {
+		for (size_t i = 0; i < canonical.size(); i++) {
+			if (canonical[i] != static_cast<int32>(i) || phashes[i] == 0) continue;
+			for (size_t j = 0; j < i; j++) {
+				if (canonical[j] != static_cast<int32>(j) || phashes[j] == 0 || sizes[i] != sizes[j]) continue;
+				if (hammingDistance(phashes[i], phashes[j]) <= threshold) {
+					canonical[i] = static_cast<int32>(j);
+					break;
+				}
+			}
+		}
+		// 代表ページ自身が別の代表にまとめられた場合をたどっておく
+		for (size_t i = 0; i < canonical.size(); i++) {
+			canonical[i] = canonical[canonical[i]];
+		}
+	}
+
+	uint32 countDuplicates(const Array<int32>& canonical) {
+		uint32 n = 0;
+		for (size_t i = 0; i < canonical.size(); i++) {
+			if (canonical[i] != static_cast<int32>(i)) n++;
+		}
+		return n;
+	}
+
+	bool writeMapping(const FilePath& doc, const Array<int32>& canonical) {
+		return atomicfile::write(Format(L"{}dedup.ini"_fmt, doc), [&canonical](const FilePath& tmp) {
+			INIWriter ini(tmp);
+			if (!ini) return false;
+			ini.write(L"numPages", canonical.size());
+			ini.write(L"numDuplicates", countDuplicates(canonical));
+			for (size_t i = 0; i < canonical.size(); i++) {
+				if (canonical[i] != static_cast<int32>(i)) {
+					ini.write(Format(keyFmt, i + 1), canonical[i] + 1);
+				}
+			}
+			return true;
+		});
+	}
+
+	// 取り込み時に書いた dedup.ini。ページ数が合わなければ使わない
+	bool readMapping(const FilePath& doc, uint32 numPages, Array<int32>& canonical) {
+		INIReader ini(Format(L"{}dedup.ini"_fmt, doc));
+		if (!ini || ini.getOr<uint32>(L"numPages", 0) != numPages) {
+			return false;
+		}
+		canonical.resize(numPages);
+		for (uint32 i = 0; i < numPages; i++) {
+			const int32 c = ini.getOr<int32>(Format(keyFmt, i + 1), 0) - 1;
+			canonical[i] = (c >= 0 && c < static_cast<int32>(i)) ? c : static_cast<int32>(i);
+		}
+		return true;
+	}
+}
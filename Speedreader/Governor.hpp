@@ -0,0 +1,78 @@
+#pragma once
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#include <Psapi.h>
+#include <Siv3D.hpp>
+#include "Loader.hpp"
+
+#pragma comment(lib, "psapi.lib")
+
+// プロセスのコミット済みメモリとOSの空きを見て、デコードする解像度の段と先読みを決める(ページのTextureは ring の枚数で決まっている)
+namespace governor
+{
+	uint64 processHighWatermark = 2048ull << 20;
+	uint64 processLowWatermark = 1536ull << 20;
+	uint64 minSystemFree = 256ull << 20;
+	int32 maxLevel = 2;
+	int32 maxInFlight = 4;    // 圧力がないときに loader が同時にデコードする枚数
+	double cooldownMs = 2000; // 段を変えてからしばらくは次の変更をしない
+
+	uint64 residentBytes = 0;
+	uint64 committedBytes = 0;
+	uint64 systemFreeBytes = ~0ull;
+	uint32 numDowngrades = 0;
+	uint32 numUpgrades = 0;
+	Stopwatch sinceChange(true);
+
+	void measure() {
+		PROCESS_MEMORY_COUNTERS_EX counters;
+		if (GetProcessMemoryInfo(GetCurrentProcess(), reinterpret_cast<PROCESS_MEMORY_COUNTERS*>(&counters), sizeof(counters))) {
+			residentBytes = counters.WorkingSetSize;
+			committedBytes = counters.PrivateUsage;
+		}
+		MEMORYSTATUSEX status;
+		status.dwLength = sizeof(status);
+		if (GlobalMemoryStatusEx(&status)) {
+			systemFreeBytes = status.ullAvailPhys;
+		}
+	}
+
+	String describe() {
+		return Format(L"tex ", loader::allocatedBytes() >> 20, L"MB / ", loader::numUsedRing(), L"/", loader::ringSlots,
+			L" slots / rss ", residentBytes >> 20, L"MB / commit ", committedBytes >> 20, L"MB / free ", systemFreeBytes >> 20,
+			L"MB / level ", loader::decodeLevel);
+	}
+
+	// 毎フレーム呼ぶ
+	void update() {
+		measure();
+		const bool systemLow = systemFreeBytes < minSystemFree;
+		const bool processHigh = committedBytes > processHighWatermark;
+		// デコード中の画像は1枚で数十〜百MBを超えるので、プロセスが重いときは1枚ずつにする
+		loader::maxInFlight = processHigh ? 1 : maxInFlight;
+		// OS全体が足りないときは画面に出ているページだけを読む
+		loader::prefetch = !systemLow;
+		if (processHigh || systemLow) {
+			if (loader::decodeLevel < maxLevel && sinceChange.ms() > cooldownMs) {
+				loader::setLevel(loader::decodeLevel + 1);
+				numDowngrades++;
+				sinceChange.restart();
+				Log << L"governor: pressure -> " << describe();
+			}
+			return;
+		}
+
+		// 1段細かくしたときに増えるデコード中の画像の分まで、プロセスにもOSにも空きがあるときだけ戻す
+		if (loader::decodeLevel > 0 && sinceChange.ms() > cooldownMs) {
+			const uint64 growth = loader::decodeBytesAt(loader::decodeLevel - 1);
+			if (committedBytes + growth < processLowWatermark && systemFreeBytes > minSystemFree * 2 + growth) {
+				loader::setLevel(loader::decodeLevel - 1);
+				numUpgrades++;
+				sinceChange.restart();
+				Log << L"governor: headroom -> " << describe();
+			}
+		}
+	}
+}
@@ -0,0 +1,589 @@
+#pragma once
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#include <shellapi.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <Siv3D.hpp>
+#include "Loader.hpp"
+#include "Bands.hpp"
+#include "Dedup.hpp"
+#include "Sequence.hpp"
+#include "Thumbnails.hpp"
+#include "TiledPage.hpp"
+#include "AtomicFile.hpp"
+
+#pragma comment(lib, "shell32.lib")
+
+// 書籍の一括取り込み
+// Speedreader.exe --ingest <書籍のディレクトリツリー> [<出力先>]
+// PDF(Ghostscriptでレンダリング)または page-NNN.png の入ったディレクトリを書籍とみなし、
+// レンダリング → 縮小 → エンコード → 書き込み のパイプラインを全コアで回してビューワーが読める形にする。
+// 書籍ごとに ingest.ini に元ファイルの署名を残し、変わっていない書籍は飛ばす。途中で止めても続きから再開できる。
+namespace ingest
+{
+	struct Options {
+		FilePath sourceRoot;
+		FilePath outputRoot;
+		int32 pageHeight = 0; // 0なら縮小しない
+		int32 dpi = 300;
+		String ghostscript = L"gswin64c";
+		int32 decodeWorkers = 0; // 0ならコア数から決める
+		int32 encodeWorkers = 0;
+		size_t queueCapacity = 16; // 段と段の間に溜める枚数。デコード済み画像でメモリを使い切らないための上限
+		int32 perceptualDedup = -1; // 0以上なら dHash の差がこのbit数以下のページも重複とみなす。-1で完全一致のみ
+		bool writeSequence = false; // 高速にめくるための差分ファイル(sequence.bin)も作る
+		int32 sequenceHeight = 1600; // 差分を取る高さ。ビューワーの表示の大きさに合わせる。0なら原寸
+		bool zoomTiles = false; // 拡大表示用のタイル(tiles/)も書いておく。書かなければビューワーが最初に拡大したときに作る
+		uint32 renderChunk = 16; // PDFを1度にレンダリングするページ数。レンダリングしたそばからデコードを始める
+	};
+
+	// 満杯なら push が、空なら pop が待つキュー。close() 後は残りを出し切ったら pop が false を返す
+	template <class T>
+	class BoundedQueue {
+	public:
+		explicit BoundedQueue(size_t capacity) : capacity(capacity) {}
+
+		void push(T item) {
+			std::unique_lock<std::mutex> lock(mutex);
+			notFull.wait(lock, [&] { return items.size() < capacity; });
+			items.push_back(std::move(item));
+			notEmpty.notify_one();
+		}
+
+		bool pop(T& item) {
+			std::unique_lock<std::mutex> lock(mutex);
+			notEmpty.wait(lock, [&] { return !items.empty() || closed; });
+			if (items.empty()) return false;
+			item = std::move(items.front());
+			items.pop_front();
+			notFull.notify_one();
+			return true;
+		}
+
+		void close() {
+			std::lock_guard<std::mutex> lock(mutex);
+			closed = true;
+			notEmpty.notify_all();
+		}
+
+	private:
+		size_t capacity;
+		std::deque<T> items;
+		bool closed = false;
+		std::mutex mutex;
+		std::condition_variable notEmpty;
+		std::condition_variable notFull;
+	};
+
+	struct Book {
+		String name;
+		FilePath pdf;        // PDFから作る場合
+		FilePath pagesDir;   // page-NNN.png がすでにある場合
+		FilePath outputDir;
+		String signature;
+		std::atomic<uint32> remaining{ 0 };
+		std::atomic<uint32> failed{ 0 };
+		uint32 numPages = 0;
+		bool numPagesKnown = true; // PDFは最後のチャンクをレンダリングするまでページ数が分からない
+		Array<uint64> perceptualHashes; // エンコード段が書く。PDFはレンダリングしながら伸ばすので mutex の中で触る
+		Array<Size> sizes;
+		std::mutex mutex;
+	};
+
+	struct PageJob {
+		std::shared_ptr<Book> book;
+		FilePath source;
+		int page = 0;
+		bool rendered = false; // render/ の一時ファイル。読んだら消す
+	};
+
+	struct EncodeJob {
+		std::shared_ptr<Book> book;
+		std::shared_ptr<Image> image;
+		int page = 0;
+	};
+
+	struct Progress {
+		std::atomic<uint32> booksTotal{ 0 };
+		std::atomic<uint32> booksDone{ 0 };
+		std::atomic<uint32> booksSkipped{ 0 };
+		std::atomic<uint32> pagesDone{ 0 };
+		std::atomic<uint32> pagesSkipped{ 0 };
+		std::atomic<uint32> errors{ 0 };
+		std::atomic<bool> finished{ false };
+		std::atomic<bool> cancelled{ false };
+	};
+
+	Array<String> commandLineArgs() {
+		int argc = 0;
+		LPWSTR* argv = CommandLineToArgvW(GetCommandLineW(), &argc);
+		Array<String> args;
+		for (int i = 0; i < argc; i++) {
+			args.push_back(argv[i]);
+		}
+		LocalFree(argv);
+		return args;
+	}
+
+	// ファイルの大きさと更新時刻。変わっていなければ取り込み済みとみなす
+	String fileSignature(const FilePath& path) {
+		WIN32_FILE_ATTRIBUTE_DATA data;
+		if (!GetFileAttributesExW(path.c_str(), GetFileExInfoStandard, &data)) {
+			return L"";
+		}
+		return Format(data.nFileSizeHigh, L":", data.nFileSizeLow, L":",
+			data.ftLastWriteTime.dwHighDateTime, L":", data.ftLastWriteTime.dwLowDateTime);
+	}
+
+	String directorySignature(const FilePath& dir) {
+		String signature;
+		const uint32 n = loader::countPages(dir);
+		signature = Format(n);
+		for (uint32 i = 0; i < n; i++) {
+			signature += L"/" + fileSignature(Format(loader::fmt, dir, i + 1));
+		}
+		return signature;
+	}
+
+	bool isUpToDate(const Book& book) {
+		INIReader manifest(Format(L"{}ingest.ini"_fmt, book.outputDir));
+		return manifest
+			&& manifest.getOr<String>(L"signature", L"") == book.signature
+			&& manifest.getOr<int>(L"complete", 0) == 1;
+	}
+
+	// 前回の取り込みが同じ元ファイルからのものか。ingest.ini がなければ違うものとみなす
+	bool isSameSource(const Book& book) {
+		INIReader manifest(Format(L"{}ingest.ini"_fmt, book.outputDir));
+		return manifest && manifest.getOr<String>(L"signature", L"") == book.signature;
+	}
+
+	// 元ファイルが変わった書籍の出力を消す。残しておくと再開の判定で古いページが使われ、
+	// ビューワーも古い帯・タイル・重複の対応表・差分を新しいページに当ててしまう。
+	// 取り込み元と出力先が同じディレクトリなら、元のページ画像は消さない
+	void clearOutputs(const Book& book) {
+		const FilePath& dir = book.outputDir;
+		if (book.pagesDir.isEmpty || FileSystem::FullPath(book.pagesDir) != FileSystem::FullPath(dir)) {
+			for (const auto& path : FileSystem::DirectoryContents(dir, false)) {
+				if (FileSystem::IsFile(path) && FileSystem::BaseName(path).startsWith(L"page-") && FileSystem::Extension(path) == L"png") {
+					FileSystem::Remove(path);
+				}
+			}
+		}
+		for (const auto& sub : { L"thumbs/", L"bands/", L"tiles/", L"cache/", L"render/" }) {
+			FileSystem::Remove(dir + sub);
+		}
+		FileSystem::Remove(Format(L"{}dedup.ini"_fmt, dir));
+		FileSystem::Remove(sequence::sequencePath(dir));
+		FileSystem::Remove(Format(L"{}ingest.ini"_fmt, dir));
+	}
+
+	void writeManifest(const Book& book, bool complete) {
+		INIWriter manifest(Format(L"{}ingest.ini"_fmt, book.outputDir));
+		manifest.write(L"signature", book.signature);
+		manifest.write(L"numPages", book.numPagesKnown ? book.numPages : 0);
+		manifest.write(L"complete", complete ? 1 : 0);
+	}
+
+	// 前回の取り込みで分かっているページ数。元ファイルが変わっていれば0
+	uint32 manifestNumPages(const Book& book) {
+		INIReader manifest(Format(L"{}ingest.ini"_fmt, book.outputDir));
+		if (!manifest || manifest.getOr<String>(L"signature", L"") != book.signature) return 0;
+		return manifest.getOr<uint32>(L"numPages", 0);
+	}
+
+	// render() が書く k 枚目(0から)。チャンクごとに名前を分け、前のチャンクのデコードを待たずに次を書けるようにする
+	FilePath renderedPath(const FilePath& outputDir, uint32 firstPage, uint32 k) {
+		return Format(L"{}{:05d}-{:03d}.png"_fmt, outputDir, firstPage, k + 1);
+	}
+
+	// Ghostscriptで firstPage から lastPage ページ目(1から)を1ページ1枚のPNGにする。
+	// 終わるまで待つが、cancelled が立ったらGhostscriptを止めて false を返す
+	bool render(const Options& options, const Book& book, const FilePath& outputDir, uint32 firstPage, uint32 lastPage, const std::atomic<bool>& cancelled) {
+		FileSystem::CreateDirectories(outputDir);
+		String command = Format(L"\"", options.ghostscript, L"\" -q -dNOPAUSE -dBATCH -dSAFER -sDEVICE=png16m -r", options.dpi,
+			L" -dFirstPage=", firstPage, L" -dLastPage=", lastPage, L" -dNumRenderingThreads=", std::thread::hardware_concurrency(),
+			L" \"-sOutputFile=", Format(L"{}{:05d}-%03d.png"_fmt, outputDir, firstPage), L"\" \"", book.pdf, L"\"");
+		STARTUPINFOW si = { sizeof(si) };
+		PROCESS_INFORMATION pi;
+		std::wstring line = command.str();
+		if (!CreateProcessW(nullptr, &line[0], nullptr, nullptr, FALSE, CREATE_NO_WINDOW, nullptr, nullptr, &si, &pi)) {
+			return false;
+		}
+		bool killed = false;
+		while (WaitForSingleObject(pi.hProcess, 100) == WAIT_TIMEOUT) {
+			if (cancelled) {
+				TerminateProcess(pi.hProcess, 1);
+				WaitForSingleObject(pi.hProcess, INFINITE);
+				killed = true;
+				break;
+			}
+		}
+		DWORD code = 1;
+		GetExitCodeProcess(pi.hProcess, &code);
+		CloseHandle(pi.hThread);
+		CloseHandle(pi.hProcess);
+		return !killed && code == 0;
+	}
+
+	String bookNameOf(const FilePath& path) {
+		std::wstring s = path.str();
+		while (!s.empty() && (s.back() == L'/' || s.back() == L'\\')) {
+			s.pop_back();
+		}
+		s = s.substr(s.find_last_of(L"/\\") + 1);
+		const size_t dot = s.find_last_of(L'.');
+		if (dot != std::wstring::npos && FileSystem::IsFile(path)) {
+			s = s.substr(0, dot);
+		}
+		return s;
+	}
+
+	// root からの相対パス。root の外なら空
+	String relativePath(const FilePath& path, const FilePath& root) {
+		std::wstring p = FileSystem::FullPath(path).str(), r = FileSystem::FullPath(root).str();
+		for (auto& c : p) if (c == L'\\') c = L'/';
+		for (auto& c : r) if (c == L'\\') c = L'/';
+		while (!r.empty() && r.back() == L'/') r.pop_back();
+		while (!p.empty() && p.back() == L'/') p.pop_back();
+		if (p.size() <= r.size() || p.compare(0, r.size(), r) != 0 || p[r.size()] != L'/') return L"";
+		return p.substr(r.size() + 1);
+	}
+
+	// ビューワーと取り込みが書籍の下に作るディレクトリ。この下は書籍として扱わない
+	bool isViewerDirectory(const String& relative) {
+		for (const auto& part : relative.split(L'/')) {
+			if (part == L"thumbs" || part == L"bands" || part == L"cache" || part == L"render" || part == L"tiles") {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// 出力先での書籍の名前。別のフォルダにある同じ名前の書籍がぶつからないよう、ツリーの中の相対パスから作る
+	// (books/A/vol1.pdf → A_vol1)。ツリーそのものが書籍なら、その名前をそのまま使う
+	String outputNameOf(const FilePath& path, const FilePath& root) {
+		std::wstring s = relativePath(path, root).str();
+		if (s.empty()) return bookNameOf(path);
+		const size_t dot = s.find_last_of(L'.');
+		if (dot != std::wstring::npos && s.find(L'/', dot) == std::wstring::npos && FileSystem::IsFile(path)) {
+			s = s.substr(0, dot);
+		}
+		for (auto& c : s) if (c == L'/') c = L'_';
+		return s;
+	}
+
+	// ツリーの中のPDFと、page-001.png を持つディレクトリを書籍として集める。
+	// 書籍の下のビューワー用のディレクトリと、ツリーの中にある出力先の下は見ない
+	Array<std::shared_ptr<Book>> findBooks(const Options& options) {
+		Array<std::shared_ptr<Book>> books;
+		Array<FilePath> candidates = FileSystem::DirectoryContents(options.sourceRoot, true);
+		candidates.push_back(options.sourceRoot);
+		const bool outputInside = !relativePath(options.outputRoot, options.sourceRoot).isEmpty;
+		for (const auto& path : candidates) {
+			if (isViewerDirectory(relativePath(path, options.sourceRoot))) continue;
+			if (outputInside && !relativePath(path, options.outputRoot).isEmpty) continue;
+			auto book = std::make_shared<Book>();
+			if (FileSystem::IsDirectory(path) && FileSystem::Exists(Format(loader::fmt, path, 1))) {
+				book->pagesDir = path;
+				book->signature = directorySignature(path);
+			}
+			else if (FileSystem::IsFile(path) && FileSystem::Extension(path) == L"pdf") {
+				book->pdf = path;
+				book->signature = fileSignature(path);
+			}
+			else {
+				continue;
+			}
+			book->name = outputNameOf(path, options.sourceRoot);
+			book->outputDir = Format(L"{}/{}/"_fmt, options.outputRoot, book->name);
+			books.push_back(book);
+		}
+		// 出力先とツリーが同じなら、前回の出力も page-001.png を持つので、ほかの書籍の出力先になっているものは外す
+		Array<std::shared_ptr<Book>> sources;
+		for (const auto& book : books) {
+			const bool isOutput = !book->pagesDir.isEmpty && std::any_of(books.begin(), books.end(), [&](const std::shared_ptr<Book>& other) {
+				return other != book && FileSystem::FullPath(other->outputDir) == FileSystem::FullPath(book->pagesDir);
+			});
+			if (!isOutput) sources.push_back(book);
+		}
+		return sources;
+	}
+
+	class Pipeline {
+	public:
+		Options options;
+		Progress progress;
+		Stopwatch stopwatch;
+
+		explicit Pipeline(const Options& o)
+			: options(o)
+			, pageJobs(o.queueCapacity)
+			, encodeJobs(o.queueCapacity) {}
+
+		~Pipeline() {
+			join();
+		}
+
+		void start() {
+			const int32 cores = std::max(2u, std::thread::hardware_concurrency());
+			const int32 decoders = options.decodeWorkers ? options.decodeWorkers : cores / 2;
+			const int32 encoders = options.encodeWorkers ? options.encodeWorkers : cores - decoders;
+			stopwatch.start();
+			driver = std::thread([this, decoders, encoders]() {
+				Array<std::thread> decodeThreads, encodeThreads;
+				for (int32 i = 0; i < decoders; i++) decodeThreads.emplace_back([this]() { decodeLoop(); });
+				for (int32 i = 0; i < encoders; i++) encodeThreads.emplace_back([this]() { encodeLoop(); });
+				feed();
+				pageJobs.close();
+				for (auto& t : decodeThreads) t.join();
+				encodeJobs.close();
+				for (auto& t : encodeThreads) t.join();
+				progress.finished = true;
+			});
+		}
+
+		// 新しいページを流すのをやめる。流してしまった分は書き終えてから止まる
+		void cancel() {
+			progress.cancelled = true;
+		}
+
+		void join() {
+			if (driver.joinable()) driver.join();
+		}
+
+		double pagesPerSecond() const {
+			const double sec = stopwatch.ms() / 1000.0;
+			return sec > 0 ? progress.pagesDone / sec : 0;
+		}
+
+		String summary() const {
+			return Format(L"books: ", progress.booksDone, L"/", progress.booksTotal, L" (skipped ", progress.booksSkipped,
+				L")  pages: ", progress.pagesDone, L" (skipped ", progress.pagesSkipped, L")  errors: ", progress.errors,
+				L"  ", pagesPerSecond(), L" pages/s");
+		}
+
+	private:
+		BoundedQueue<PageJob> pageJobs;
+		BoundedQueue<EncodeJob> encodeJobs;
+		std::thread driver;
+
+		// レンダリング段。書籍を1冊ずつ、PDFは renderChunk ページずつレンダリングしてページをキューに流す。
+		// 後ろの段が詰まっていれば push で待つので、先にレンダリングしすぎることはない
+		void feed() {
+			auto books = findBooks(options);
+			progress.booksTotal = static_cast<uint32>(books.size());
+			for (auto& book : books) {
+				if (progress.cancelled) break;
+				if (isUpToDate(*book)) {
+					progress.booksSkipped++;
+					progress.booksDone++;
+					continue;
+				}
+				if (!isSameSource(*book) && FileSystem::Exists(book->outputDir)) {
+					Log << L"ingest: " << book->name << L" changed, clearing " << book->outputDir;
+					clearOutputs(*book);
+				}
+				FileSystem::CreateDirectories(book->outputDir);
+				// 流し終えるまで finishBook() が呼ばれないよう、1つ多く数えておく
+				book->remaining = 1;
+				if (!book->pdf.isEmpty) {
+					feedPDF(book);
+				}
+				else {
+					book->numPages = loader::countPages(book->pagesDir);
+					reserve(*book, book->numPages);
+					writeManifest(*book, false);
+					for (uint32 i = 0; i < book->numPages; i++) {
+						queuePage(book, Format(loader::fmt, book->pagesDir, i + 1), i, false);
+					}
+				}
+				if (--book->remaining == 0) {
+					finishBook(*book);
+				}
+			}
+		}
+
+		// エンコード段が書くページごとの配列を numPages ページ分にする
+		void reserve(Book& book, uint32 numPages) {
+			std::lock_guard<std::mutex> lock(book.mutex);
+			book.perceptualHashes.resize(numPages, 0);
+			book.sizes.resize(numPages, Size(0, 0));
+		}
+
+		// 再開時は書き終わっているページを飛ばす。止められたら流さず、書籍は未完了のまま残す
+		void queuePage(const std::shared_ptr<Book>& book, const FilePath& source, uint32 page, bool rendered) {
+			if (FileSystem::Exists(Format(loader::fmt, book->outputDir, page + 1)) || progress.cancelled) {
+				if (progress.cancelled) {
+					book->failed++;
+				}
+				else {
+					progress.pagesSkipped++;
+				}
+				if (rendered) FileSystem::Remove(source);
+				return;
+			}
+			book->remaining++;
+			PageJob job;
+			job.book = book;
+			job.source = source;
+			job.page = page;
+			job.rendered = rendered;
+			pageJobs.push(job);
+		}
+
+		// PDFを renderChunk ページずつレンダリングして流す。チャンクが埋まらなかったら最後のページまで来た。
+		// 再開時は書き終わっていない最初のページから始め、前回の取り込みでページ数が分かっていて揃っていればレンダリングしない
+		void feedPDF(const std::shared_ptr<Book>& book) {
+			const FilePath dir = Format(L"{}render/"_fmt, book->outputDir);
+			FileSystem::Remove(dir);
+			uint32 first = 0;
+			while (FileSystem::Exists(Format(loader::fmt, book->outputDir, first + 1))) {
+				first++;
+			}
+			const uint32 known = manifestNumPages(*book);
+			if (known > 0 && first >= known) {
+				book->numPages = known;
+				reserve(*book, known);
+				writeManifest(*book, false);
+				progress.pagesSkipped += known;
+				return;
+			}
+			const uint32 chunk = Clamp(options.renderChunk, 1u, 999u); // 出力名の %03d に収まる数
+			book->numPagesKnown = false;
+			book->numPages = first;
+			reserve(*book, first);
+			writeManifest(*book, false);
+			progress.pagesSkipped += first;
+			for (uint32 page = first; !progress.cancelled; page += chunk) {
+				const bool ok = render(options, *book, dir, page + 1, page + chunk, progress.cancelled);
+				uint32 n = 0;
+				while (n < chunk && FileSystem::Exists(renderedPath(dir, page + 1, n))) {
+					n++;
+				}
+				if (progress.cancelled) {
+					// 止めたGhostscriptが書きかけたものかもしれないので流さない
+					for (uint32 k = 0; k < n; k++) FileSystem::Remove(renderedPath(dir, page + 1, k));
+					break;
+				}
+				book->numPages = page + n;
+				reserve(*book, book->numPages);
+				for (uint32 k = 0; k < n; k++) {
+					queuePage(book, renderedPath(dir, page + 1, k), page + k, true);
+				}
+				if (n < chunk) {
+					// 最後のページより後ろから始めたチャンクはGhostscriptがエラーにするので、1ページも出せなかったときだけ失敗とする
+					if (!ok && page == 0) {
+						Log << L"ingest: failed to render " << book->pdf;
+						progress.errors++;
+					}
+					else {
+						book->numPagesKnown = true;
+					}
+					break;
+				}
+			}
+			// 最後までレンダリングできなかった書籍は未完了のまま残す
+			if (!book->numPagesKnown) {
+				book->failed++;
+			}
+		}
+
+		// デコード・縮小段
+		void decodeLoop() {
+			PageJob job;
+			while (pageJobs.pop(job)) {
+				auto image = std::make_shared<Image>(job.source);
+				if (job.rendered) {
+					FileSystem::Remove(job.source);
+				}
+				if (*image && options.pageHeight > 0 && image->height > options.pageHeight) {
+					image->scale(image->width * options.pageHeight / image->height, options.pageHeight);
+				}
+				EncodeJob out;
+				out.book = job.book;
+				out.image = image;
+				out.page = job.page;
+				encodeJobs.push(out);
+			}
+		}
+
+		// エンコード・書き込み段。ビューワーが使うサムネイルと帯もここで作る
+		void encodeLoop() {
+			EncodeJob job;
+			while (encodeJobs.pop(job)) {
+				const Image& image = *job.image;
+				const FilePath& dir = job.book->outputDir;
+				bool ok = static_cast<bool>(image);
+				if (ok) {
+					const int32 w = std::max(1, image.width * thumbnail::height / std::max(1, image.height));
+					const FilePath thumb = thumbnail::thumbnailPath(dir, job.page);
+					FileSystem::CreateDirectories(FileSystem::ParentPath(thumb));
+					image.scaled(w, thumbnail::height).save(thumb);
+					const int32 split = bands::bandsFor(image.width, image.height);
+					if (split > 1) {
+						bands::write(image, dir, job.page, split);
+					}
+					if (options.zoomTiles) {
+						zoom::writeTiles(image, dir, job.page);
+					}
+					if (options.perceptualDedup >= 0) {
+						const uint64 hash = dedup::perceptualHash(image);
+						std::lock_guard<std::mutex> lock(job.book->mutex);
+						job.book->perceptualHashes[job.page] = hash;
+						job.book->sizes[job.page] = image.size;
+					}
+					ok = atomicfile::save(image, Format(loader::fmt, dir, job.page + 1));
+				}
+				if (ok) {
+					progress.pagesDone++;
+				}
+				else {
+					progress.errors++;
+					job.book->failed++;
+				}
+				if (--job.book->remaining == 0) {
+					finishBook(*job.book);
+				}
+			}
+		}
+
+		// 失敗したページがあれば complete にしないので、次回の実行でそのページだけやり直す
+		void finishBook(const Book& book) {
+			uint32 numDuplicates = 0;
+			if (book.failed == 0) {
+				// 重複ページの対応表。ビューワーはこれがあればハッシュを取り直さない。
+				// 再開で今回エンコードしなかったページは dHash がないので完全一致だけで判定する
+				Array<int32> canonical = dedup::findExactDuplicates(book.outputDir, book.numPages, loader::fmt);
+				if (options.perceptualDedup >= 0) {
+					dedup::mergePerceptual(canonical, book.perceptualHashes, book.sizes, options.perceptualDedup);
+				}
+				dedup::writeMapping(book.outputDir, canonical);
+				numDuplicates = dedup::countDuplicates(canonical);
+
+				// 差分は全ページがそろってから、ページ順に作る
+				if (options.writeSequence) {
+					const FilePath dir = book.outputDir;
+					if (!sequence::write(dir, book.numPages, options.sequenceHeight, [dir](int page) { return Image(Format(loader::fmt, dir, page + 1)); })) {
+						Log << L"ingest: failed to write " << sequence::sequencePath(dir);
+						progress.errors++;
+					}
+				}
+			}
+			writeManifest(book, book.failed == 0);
+			if (!book.pdf.isEmpty) {
+				FileSystem::Remove(Format(L"{}render/"_fmt, book.outputDir));
+			}
+			progress.booksDone++;
+			Log << L"ingest: " << book.name << L" (" << book.numPages << L" pages, " << numDuplicates << L" duplicates)";
+		}
+	};
+}
@@ -0,0 +1,96 @@
+#pragma once
+#include <algorithm>
+#include <Siv3D.hpp>
+
+// 画面に並べたページや書籍の位置を引くための索引
+// 描画するときに作っておき、クリックやポインタの下にあるもの、画面に出ている範囲を同じ索引に問い合わせる。
+namespace layout
+{
+	// 同じ大きさのセルを columns 列 rows 行に並べた格子。左上のセルが first 番目で、左から右へ(rightToLeft なら右から左へ)並ぶ。
+	// 点からセルの番号を割り算で引くので O(1)
+	class Grid {
+	public:
+		Vec2 origin = Vec2(0, 0);
+		Vec2 cell = Vec2(1, 1);
+		int32 columns = 0;
+		int32 rows = 0;
+		int32 first = 0;
+		int32 count = 0;    // 並べるものの総数。first + columns * rows がこれを超える分のセルは空
+		bool rightToLeft = false;
+
+		void set(const Vec2& o, const Vec2& c, int32 numColumns, int32 numRows, int32 firstItem, int32 numItems, bool rtl = false) {
+			origin = o;
+			cell = c;
+			columns = std::max(0, numColumns);
+			rows = std::max(0, numRows);
+			first = firstItem;
+			count = numItems;
+			rightToLeft = rtl;
+		}
+
+		// 画面に出ている番号の範囲 [begin(), end())
+		int32 begin() const {
+			return std::min(first, count);
+		}
+
+		int32 end() const {
+			return std::max(begin(), std::min(first + columns * rows, count));
+		}
+
+		int32 size() const {
+			return end() - begin();
+		}
+
+		RectF rect(int32 index) const {
+			const int32 k = index - first;
+			int32 x = k % std::max(1, columns);
+			const int32 y = k / std::max(1, columns);
+			if (rightToLeft) x = columns - x - 1;
+			return RectF(origin.x + cell.x * x, origin.y + cell.y * y, cell.x, cell.y);
+		}
+
+		// 点 p の下にあるものの番号。なければ -1
+		int32 at(const Vec2& p) const {
+			if (cell.x <= 0 || cell.y <= 0) return -1;
+			const double fx = (p.x - origin.x) / cell.x, fy = (p.y - origin.y) / cell.y;
+			if (fx < 0 || fy < 0 || fx >= columns || fy >= rows) return -1;
+			int32 x = static_cast<int32>(fx);
+			const int32 y = static_cast<int32>(fy);
+			if (rightToLeft) x = columns - x - 1;
+			const int32 index = first + y * columns + x;
+			return index < end() ? index : -1;
+		}
+	};
+
+	// 長さの違う区間を隙間なく並べたもの(ライブラリのモザイクで、書籍ごとに行数が違うときの行)。
+	// 区間の始まりを昇順に持っていて、位置から区間を二分探索で O(log n) で引く
+	class Intervals {
+	public:
+		void clear() {
+			starts.clear();
+			total = 0;
+		}
+
+		// 長さ length の区間を末尾に足し、その始まりを返す
+		double add(double length) {
+			starts.push_back(total);
+			total += length;
+			return starts.back();
+		}
+
+		double length() const {
+			return total;
+		}
+
+		// 位置 v を含む区間の番号。なければ -1
+		int32 find(double v) const {
+			if (v < 0 || v >= total) return -1;
+			auto it = std::upper_bound(starts.begin(), starts.end(), v);
+			return static_cast<int32>(it - starts.begin()) - 1;
+		}
+
+	private:
+		Array<double> starts;
+		double total = 0;
+	};
+}
@@ -1,85 +1,576 @@
-#pragma once
-#include <Siv3D.hpp>
-#include <cstdio>
-#include <string>
-#include <vector>
-#include "AssetLoader.hpp"
-
-namespace loader
-{
-	bool useConcurrentLoader = false;
-	s3d::experimental::TextureLoader loader;
-	Texture nullPage;
-	Array<Texture> frontPage(2);
-	Array<FilePath> paths;
-	uint32 numPages;
-	uint32 loadingPage;
-	s3d::PyFmtString fmt = L"{}page-{:03d}.png"_fmt;
-
-	void loadPDF(String doc) {
-		frontPage.resize(2);
-		frontPage[0] = Texture(Format(fmt, doc, 1));
-		frontPage[1] = Texture(Format(fmt, doc, 2));
-
-		// TODO: iniɃy[W|ĂȂt@CVXẽ`FbN͂Ȃ
-		// TODO: dds΂ǂނ悤ɂ
-		int i = 3;
-		paths.clear();
-
-		while (true) {
-			auto path = Format(fmt, doc, i);
-			if (!FileSystem::Exists(path)) break;
-			paths.push_back(path);
-			i++;
-		}
-
-		numPages = i - 1;
-
-		// TODO: numPages0Ȃx
-		if (useConcurrentLoader) {
-			loader = s3d::experimental::TextureLoader(paths, true);
-		}
-		else {
-			loadingPage = 0;
-		}
-	}
-
-	void keepLoading() {
-		if (useConcurrentLoader) {
-			if (loader.isActive() && !loader.done())
-			{
-				// [h摜珇 Texture 쐬B
-				// 1  upadate ō쐬 Texture ̍ő吔ȂƁAt[[g̒ቺh邪A
-				// ő吔 1@ƁA100  Texture 쐬ɂ͍Œł 100 t[KvɂȂB
-				const int32 maxTextureCreationPerFrame = 10;
-				loader.update(maxTextureCreationPerFrame);
-			}
-		}
-		else {
-			if (loadingPage < paths.size()) {
-				frontPage.push_back(Texture(paths[loadingPage]));
-				loadingPage++;
-			}
-		}
-	}
-
-	const Texture& getPage(int i) {
-		if (useConcurrentLoader) {
-			if (i < 2) {
-				return frontPage[i];
-			}
-			if (i >= numPages || !loader.getState(i - 2)) {
-				return nullPage;
-			}
-			return loader.getAsset(i - 2);
-		}
-		else {
-			if (i < frontPage.size()) {
-				return frontPage[i];
-			}
-			else {
-				return nullPage;
-			}
-		}
-	}
-}
\ No newline at end of file
+#pragma once
+#include <ppltasks.h>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <Siv3D.hpp>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "AtomicFile.hpp"
+#include "Bands.hpp"
+#include "Dedup.hpp"
+#include "SharedCache.hpp"
+#include "Sequence.hpp"
+
+namespace loader
+{
+	bool useConcurrentLoader = true; // false にするとUIスレッドで1フレーム1枚ずつ読む(比較用)
+	bool useDedup = true;            // 同じ内容のページは1枚だけ読んでTextureを共有する
+	bool useSequence = true;         // sequence.bin があれば隣のページとの差分からデコードする
+	Texture nullPage;
+
+	enum class PageState {
+		Empty,
+		Decoding,
+		Loaded,
+	};
+
+	struct Slot {
+		PageState state = PageState::Empty;
+		int32 ring = -1; // 使っている ring の番号
+		Size size = Size(0, 0); // ring のTextureのうちページが入っている左上の部分
+		bool refreshing = false; // 今の段より粗く読み込んであり、今の段で読み直している
+		std::shared_ptr<Image> image;
+		Size imageSize = Size(0, 0); // image のうちページが入っている部分
+		concurrency::task<void> task;
+	};
+
+	Array<Slot> slots;
+	Array<uint32> inFlight;     // デコード中のページ番号
+	String document;
+	uint32 numPages;
+	uint32 numLoadedPages;
+	uint32 startPage;
+	int32 viewFirst = 0;        // 画面に出ているページの範囲。ここから近い順に読む
+	int32 viewCount = 2;
+	int32 decodeLevel = 0;      // デコードする解像度の段(メモリが足りないときに governor が上げる)
+	int32 maxInFlight = 4;
+	bool prefetch = true;       // false なら画面に出ているページだけ読む
+	uint32 numEvicted = 0;
+	Size pageSize(0, 0);        // 最初に読んだページの大きさ。レイアウトの基準にする
+	s3d::PyFmtString fmt = L"{}page-{:03d}.png"_fmt;
+	s3d::PyFmtString cacheFmt = L"{}cache/page-{:03d}.dds"_fmt;
+	Array<concurrency::task<void>> persistTasks;
+	const uint32 warmCachePages = 2; // 見開き
+
+	// ページごとの代表ページ。空なら重複はまだわかっていない(全ページが自分自身の代表)
+	Array<int32> canonical;
+	uint32 numDuplicates = 0;
+	concurrency::task<Array<int32>> dedupTask;
+	String dedupDocument;       // dedupTask がハッシュを取っている書籍。開き直したら結果は捨てる
+
+	sequence::Reader sequenceReader;
+
+	// ページのTextureは ringSlots 枚の同じ大きさ(ringBaseSize)の DynamicTexture を使い回し、fill() で中身だけ入れ替える。
+	// 最初に使うときに作り、設定が変わらない限り捨てない。縦横比の違う書籍や粗い段のページは左上に詰めて入れ、その部分だけ描く
+	Size ringBaseSize(1200, 1600); // 1枚の大きさ。ページはこの枠に縦横比を保って収める
+	int32 ringSlots = 64;
+	Size ringSize(0, 0);           // 今の書籍と段でページを入れる大きさ
+	Array<DynamicTexture> ring;    // 番号は Slot::ring から引く
+	Array<int32> freeRing;         // どのページも使っていない ring の番号
+
+	// キャッシュの振る舞いを計測するためのカウンタ。画面に入ったページが読み込み済みだったか(ページごとに1回)
+	uint32 numHits = 0;
+	uint32 numMisses = 0;
+
+	// page-001.png から連番で存在するページ数を数える
+	uint32 countPages(const String& doc) {
+		uint32 n = 0;
+		while (FileSystem::Exists(Format(fmt, doc, n + 1))) {
+			n++;
+		}
+		return n;
+	}
+
+	FilePath getPagePath(int i) {
+		return Format(fmt, document, i + 1);
+	}
+
+	FilePath getCachePath(int i) {
+		return Format(cacheFmt, document, i + 1);
+	}
+
+	Size readImageSize(const FilePath& path);
+
+	// 前回保存したDDSが今の ring の大きさならそちらを読む。PNGのデコードも縮小もいらないので速い
+	FilePath getSourcePath(int i) {
+		const FilePath cache = getCachePath(i);
+		return FileSystem::Exists(cache) && readImageSize(cache) == ringSize ? cache : getPagePath(i);
+	}
+
+	uint64 bytesOf(const Size& size) {
+		return static_cast<uint64>(size.x) * size.y * sizeof(Color);
+	}
+
+	// 作ってあるTextureの合計
+	uint64 allocatedBytes() {
+		uint64 n = 0;
+		for (const auto& t : ring) {
+			if (t) n++;
+		}
+		return n * bytesOf(ringBaseSize);
+	}
+
+	// 今の段より粗く読み込んであるページ。細かい段で読み込んであるものはそのまま使う
+	bool isStale(const Slot& s) {
+		return s.state == PageState::Loaded && s.size.y < ringSize.y;
+	}
+
+	// 大きさ page のページを ringBaseSize に収め、level 段分縮めた1枚の大きさ
+	Size slotSize(const Size& page, int32 level) {
+		Size s = ringBaseSize;
+		if (page.x > 0 && page.y > 0) {
+			const double k = std::min(1.0, std::min(static_cast<double>(ringBaseSize.x) / page.x, static_cast<double>(ringBaseSize.y) / page.y));
+			s = Size(std::max(1, static_cast<int32>(page.x * k)), std::max(1, static_cast<int32>(page.y * k)));
+		}
+		return Size(std::max(1, s.x >> level), std::max(1, s.y >> level));
+	}
+
+	// level 段で同時にデコードしているページが持つCPU側のメモリ。governor が段を戻せるかの見積もりに使う
+	uint64 decodeBytesAt(int32 level) {
+		return maxInFlight * (bytesOf(slotSize(pageSize, level)) + bytesOf(ringBaseSize));
+	}
+
+	// ページを ring の1枚の大きさの左上に置く。空いたところは白。背景スレッドで呼ぶ
+	Image padToSlot(const Image& image, const Size& slot) {
+		if (!image || image.size == slot) return image;
+		Image padded(slot, Color(255));
+		for (int32 y = 0; y < image.height; y++) {
+			std::memcpy(padded.data() + static_cast<size_t>(y) * slot.x, image.data() + static_cast<size_t>(y) * image.width, image.width * sizeof(Color));
+		}
+		return padded;
+	}
+
+	void scaleToLevel(Image& image, int32 level) {
+		if (level > 0 && image) {
+			image.scale(std::max(1, image.width >> level), std::max(1, image.height >> level));
+		}
+	}
+
+	// 大きなページは帯に分けたものがあれば並列でデコードし、なければ次回のために帯を書き出す
+	Image decodePage(const FilePath& doc, int page, const FilePath& path, int32 level) {
+		Image image;
+		const int32 n = path.endsWith(L".png") ? bands::numBands(doc, page) : 0;
+		if (n > 0) {
+			image = bands::decode(doc, page, n);
+		}
+		if (!image) {
+			image = Image(path);
+			const int32 split = bands::bandsFor(image.width, image.height);
+			if (bands::writeOnDecode && split > 1 && path.endsWith(L".png")) {
+				// 書き出しはこのページの表示を待たせないよう別のタスクで
+				bands::writeAsync(image, doc, page, split);
+			}
+		}
+		scaleToLevel(image, level);
+		return image;
+	}
+
+	int32 resolve(int32 i) {
+		return canonical.empty() ? i : canonical[i];
+	}
+
+	void release(Slot& s) {
+		freeRing.push_back(s.ring);
+		s.ring = -1;
+		s.state = PageState::Empty;
+		numLoadedPages--;
+	}
+
+	// ページ c (代表ページ)が画面に出ているか。重複ページの代わりに出ている場合も含む
+	bool isVisible(int32 c) {
+		for (int32 i = std::max(0, viewFirst); i < std::min(viewFirst + viewCount, static_cast<int32>(numPages)); i++) {
+			if (resolve(i) == c) return true;
+		}
+		return false;
+	}
+
+	// 重複がわかったら、それまでに別々に読んでしまったページのTextureは捨てて代表ページに寄せる
+	void applyDedup(const Array<int32>& c) {
+		canonical = c;
+		numDuplicates = dedup::countDuplicates(canonical);
+		for (uint32 i = 0; i < numPages; i++) {
+			if (canonical[i] != static_cast<int32>(i) && slots[i].state == PageState::Loaded && !slots[i].image) {
+				release(slots[i]);
+			}
+		}
+		Log << L"dedup: " << numDuplicates << L" duplicate pages in " << document;
+	}
+
+	// 別のビューワーがデコード済みなら共有キャッシュから取り、なければデコードして共有キャッシュに置く。
+	// 背景スレッドで ring の大きさ(size)まで縮める。共有キャッシュは大きさごとに分けて置く
+	Image loadPage(const FilePath& doc, int page, const FilePath& path, const Size& size) {
+		Image image;
+		if (!sharedcache::get(doc, page, size, image)) {
+			// DDSのキャッシュはすでに size なのでそのまま読む。差分が size より小さいと拡大になるのでPNGから読む
+			if (sequenceReader && doc == document && path != getCachePath(page) && sequenceReader.sizeOf(page).y >= size.y) {
+				image = sequenceReader.read(page);
+			}
+			if (!image) {
+				image = decodePage(doc, page, path, 0);
+			}
+			if (image && image.size != size) {
+				image.scale(size.x, size.y);
+			}
+			sharedcache::put(doc, page, image);
+		}
+		return image;
+	}
+
+	int32 numUsedRing() {
+		return static_cast<int32>(ring.size() - freeRing.size());
+	}
+
+	int32 farthestEvictable();
+
+	// 解像度の段を変える。Textureはそのまま使い、粗くしたときは読み込んであるページもそのまま出しておく。
+	// 細かくしたときは keepLoading() が画面に近い順に読み直す
+	void setLevel(int32 level) {
+		decodeLevel = level;
+		ringSize = slotSize(pageSize, decodeLevel);
+	}
+
+	// 空いている ring の番号。全部使っていれば、画面から遠いページを1枚捨てて空ける。
+	// すでに作ってあるTextureを先に使い、なければ次の fill() で作る
+	int32 acquireRing() {
+		if (freeRing.isEmpty) {
+			const int32 farthest = farthestEvictable();
+			if (farthest < 0) return -1;
+			release(slots[farthest]);
+			numEvicted++;
+		}
+		size_t k = freeRing.size() - 1;
+		for (size_t j = 0; j < freeRing.size(); j++) {
+			if (ring[freeRing[j]]) {
+				k = j;
+				break;
+			}
+		}
+		const int32 r = freeRing[k];
+		freeRing.erase(freeRing.begin() + k);
+		return r;
+	}
+
+	// image は padToSlot() で ring の1枚の大きさにしたもの、size はそのうちページが入っている部分
+	void setPage(uint32 page, const Image& image, const Size& size) {
+		Slot& s = slots[page];
+		s.refreshing = false;
+		if (!image || image.size != ringBaseSize || size.y < ringSize.y) {
+			// 今の段より粗くデコードしたものは使わず、読み直す。前の段で読み込んであればそれを出しておく
+			if (s.state == PageState::Decoding) s.state = PageState::Empty;
+			return;
+		}
+		if (s.state != PageState::Loaded) {
+			s.ring = acquireRing();
+			if (s.ring < 0) {
+				s.state = PageState::Empty;
+				return;
+			}
+			numLoadedPages++;
+		}
+		ring[s.ring].fill(image);
+		s.size = size;
+		s.state = PageState::Loaded;
+	}
+
+	void waitPersist() {
+		concurrency::when_all(std::begin(persistTasks), std::end(persistTasks)).wait();
+		persistTasks.clear();
+	}
+
+	void waitDecoding() {
+		for (uint32 page : inFlight) {
+			slots[page].task.wait();
+		}
+		inFlight.clear();
+	}
+
+	bool isLoaded(int i);
+
+	// 新しく画面に入ったページごとに、読み込み済みだったかを数える
+	void setView(int32 first, int32 count) {
+		count = std::max(1, count);
+		for (int32 i = std::max(0, first); i < std::min(first + count, static_cast<int32>(numPages)); i++) {
+			if (i >= viewFirst && i < viewFirst + viewCount) continue;
+			if (isLoaded(i)) {
+				numHits++;
+			}
+			else {
+				numMisses++;
+			}
+		}
+		viewFirst = first;
+		viewCount = count;
+	}
+
+	// 画面に出ている範囲からの遠さ。めくるのは前方が多いので、後ろのページは2倍遠いとみなす
+	int32 distanceFromView(int32 i) {
+		if (i < viewFirst) return 2 * (viewFirst - i);
+		if (i >= viewFirst + viewCount) return i - (viewFirst + viewCount - 1);
+		return 0;
+	}
+
+	// 画面から近い順に、まだ読んでいないページを探す。
+	// 前2ページにつき後ろ1ページの順に見るので、distanceFromView() の近い順と同じになる
+	int32 nextPageToLoad() {
+		// ring が埋まっていたら、入っているページのうち一番遠いものより近いページだけ読む。
+		// 画面に出ているページで埋まっていたら、読んでも入れる場所がない
+		int32 limit = std::numeric_limits<int32>::max();
+		if (freeRing.isEmpty) {
+			const int32 farthest = farthestEvictable();
+			if (farthest < 0) return -1;
+			limit = distanceFromView(farthest);
+		}
+		if (!prefetch) {
+			limit = std::min(limit, 1); // 画面に出ているページだけ
+		}
+		// 前の段のまま出しているページも読み直す
+		auto wanted = [limit](int32 i) {
+			const Slot& s = slots[resolve(i)];
+			return distanceFromView(i) < limit && (s.state == PageState::Empty || (isStale(s) && !s.refreshing));
+		};
+		const int32 n = static_cast<int32>(numPages);
+		int32 forward = std::max(0, viewFirst), backward = std::min(viewFirst, n) - 1;
+		while ((forward < n && distanceFromView(forward) < limit) || (backward >= 0 && distanceFromView(backward) < limit)) {
+			for (int k = 0; k < 2 && forward < n; k++, forward++) {
+				if (wanted(forward)) return resolve(forward);
+			}
+			if (backward >= 0) {
+				if (wanted(backward)) return resolve(backward);
+				backward--;
+			}
+		}
+		return -1;
+	}
+
+	// PNG/DDSのヘッダだけ読んで大きさを調べる。デコードを待たずにレイアウトを決めるため
+	Size readImageSize(const FilePath& path) {
+		BinaryReader reader(path);
+		uint8 header[24] = {};
+		if (!reader || reader.read(header, sizeof(header)) != sizeof(header)) {
+			return Size(0, 0);
+		}
+		auto be32 = [&](int k) { return (header[k] << 24) | (header[k + 1] << 16) | (header[k + 2] << 8) | header[k + 3]; };
+		auto le32 = [&](int k) { return header[k] | (header[k + 1] << 8) | (header[k + 2] << 16) | (header[k + 3] << 24); };
+		if (header[1] == 'P' && header[2] == 'N' && header[3] == 'G') {
+			return Size(be32(16), be32(20)); // IHDR
+		}
+		if (header[0] == 'D' && header[1] == 'D' && header[2] == 'S') {
+			return Size(le32(16), le32(12));
+		}
+		return Image(path).size;
+	}
+
+	void loadPDF(String doc, uint32 start = 0) {
+		waitDecoding();
+		document = doc;
+
+		// TODO: iniにページ数が掛かれているならファイルシステムのチェックはいらない
+		numPages = countPages(doc);
+
+		// ページがない文書は呼ぶ側(loadNewDocument)で警告して開かない
+		startPage = numPages ? std::min(start, numPages - 1) : 0;
+		slots.clear();
+		slots.resize(numPages);
+		numLoadedPages = 0;
+		// ring は前の書籍のものをそのまま使う。作り直すのは設定で枚数か大きさを変えたときだけ
+		if (ring.size() != static_cast<size_t>(ringSlots) || (!ring.isEmpty && ring[0] && Size(ring[0].width, ring[0].height) != ringBaseSize)) {
+			ring.clear();
+			ring.resize(ringSlots);
+			Log << L"loader: ring " << ringSlots << L" x " << ringBaseSize.x << L"x" << ringBaseSize.y;
+		}
+		freeRing.clear();
+		for (size_t i = 0; i < ring.size(); i++) {
+			freeRing.push_back(static_cast<int32>(ring.size() - 1 - i));
+		}
+		viewCount = 0; // 前の文書で画面に出ていた範囲とは比べない
+		setView(startPage, 2);
+
+		// UIスレッドでは枠とページを入れる大きさを決めるためにヘッダだけ読む
+		pageSize = numPages ? readImageSize(getPagePath(startPage)) : Size(0, 0);
+		setLevel(decodeLevel);
+
+		// 差分のキーフレームはDDSのキャッシュではなくPNGから作る。差分を作ったときと同じ画素にするため
+		sequenceReader.close();
+		if (useSequence && numPages > 1) {
+			// 前へ進むカーソルと後ろへ戻るカーソルが同時にデコードできるよう、同時にデコードする枚数だけカーソルを持つ
+			const bool opened = sequenceReader.open(doc, numPages, std::max(2, maxInFlight), [doc](int page) {
+				return decodePage(doc, page, Format(fmt, doc, page + 1), 0);
+			});
+			if (opened) Log << L"sequence: " << sequence::sequencePath(doc);
+		}
+
+		// 取り込み時に重複を調べてあればすぐ使う。なければ背景でページのファイルをハッシュする
+		canonical.clear();
+		numDuplicates = 0;
+		dedupDocument = L"";
+		if (useDedup && numPages > 1) {
+			Array<int32> c;
+			if (dedup::readMapping(doc, numPages, c)) {
+				applyDedup(c);
+			}
+			else {
+				const uint32 n = numPages;
+				const s3d::PyFmtString pageFmt = fmt;
+				dedupDocument = doc;
+				// 次に開いたときにハッシュを取り直さないよう、結果は dedup.ini に書いておく
+				dedupTask = concurrency::create_task([doc, n, pageFmt]() {
+					bool allRead = false;
+					Array<int32> c = dedup::findExactDuplicates(doc, n, pageFmt, &allRead);
+					if (allRead) {
+						dedup::writeMapping(doc, c);
+					}
+					return c;
+				});
+			}
+		}
+
+		// 最初の見開きも含めてデコードは keepLoading() で背景スレッドに任せる
+		if (!useConcurrentLoader) {
+			for (uint32 i = startPage; i < std::min(startPage + 2, numPages); i++) {
+				setPage(i, padToSlot(loadPage(document, i, getSourcePath(i), ringSize), ringBaseSize), ringSize);
+			}
+		}
+	}
+
+	void keepLoading() {
+		if (useConcurrentLoader) {
+			// ロードが完了した画像から順次 ring の Texture に転送する。
+			// 1 回の update で転送する最大数を少なくすると、フレームレートの低下を防げるが、
+			// 最大数が 1　だと、100 枚を転送するには最低でも 100 フレーム必要になる。
+			const int32 maxTextureCreationPerFrame = 10;
+			if (!dedupDocument.isEmpty && dedupTask.is_done()) {
+				if (dedupDocument == document) {
+					applyDedup(dedupTask.get());
+				}
+				dedupDocument = L"";
+			}
+
+			int32 created = 0;
+			for (size_t k = 0; k < inFlight.size() && created < maxTextureCreationPerFrame;) {
+				Slot& s = slots[inFlight[k]];
+				if (!s.task.is_done()) {
+					k++;
+					continue;
+				}
+				if (resolve(inFlight[k]) == static_cast<int32>(inFlight[k])) {
+					setPage(inFlight[k], *s.image, s.imageSize);
+				}
+				else if (s.state == PageState::Loaded) {
+					release(s); // 読んでいる間に重複とわかったページは代表ページに任せる
+				}
+				else if (s.state == PageState::Decoding) {
+					s.state = PageState::Empty;
+				}
+				s.refreshing = false;
+				s.image.reset();
+				inFlight.erase(inFlight.begin() + k);
+				created++;
+			}
+
+			while (static_cast<int32>(inFlight.size()) < maxInFlight) {
+				int32 page = nextPageToLoad();
+				if (page < 0) break;
+				Slot& s = slots[page];
+				if (s.state == PageState::Loaded) {
+					s.refreshing = true;
+				}
+				else {
+					s.state = PageState::Decoding;
+				}
+				auto image = std::make_shared<Image>();
+				s.image = image;
+				s.imageSize = ringSize;
+				const FilePath doc = document;
+				const FilePath path = getSourcePath(page);
+				const Size size = ringSize, slot = ringBaseSize;
+				s.task = concurrency::create_task([image, doc, page, path, size, slot]() {
+					*image = padToSlot(loadPage(doc, page, path, size), slot);
+				});
+				inFlight.push_back(page);
+			}
+		}
+		else {
+			int32 page = nextPageToLoad();
+			if (page >= 0) {
+				setPage(page, padToSlot(loadPage(document, page, getSourcePath(page), ringSize), ringBaseSize), ringSize);
+			}
+		}
+	}
+
+	// 捨ててよいページのうち画面から一番遠いもの。なければ -1
+	int32 farthestEvictable() {
+		int32 farthest = -1;
+		for (int32 i = 0; i < static_cast<int32>(numPages); i++) {
+			if (slots[i].state != PageState::Loaded) continue;
+			if (isVisible(i)) continue; // 画面に出ているページ(とその重複の代表)は残す
+			if (farthest < 0 || distanceFromView(i) > distanceFromView(farthest)) {
+				farthest = i;
+			}
+		}
+		return farthest;
+	}
+
+	bool isLoaded(int i) {
+		if (i < 0 || i >= static_cast<int>(numPages)) {
+			return false;
+		}
+		return slots[resolve(i)].state == PageState::Loaded;
+	}
+
+	uint32 numLoaded() {
+		return numLoadedPages;
+	}
+
+	// 次に開いたときすぐ出せるよう、first からの見開きを ring の大きさ(Textureに入れたもの)のDDSで保存しておく。
+	// それ以外のページのキャッシュは消すので、1冊あたりのキャッシュは数MBで済む。保存は背景で行い待たない
+	void persistWarmCache(uint32 first) {
+		if (!numPages) return;
+		persistTasks.erase(std::remove_if(persistTasks.begin(), persistTasks.end(), [](const concurrency::task<void>& t) { return t.is_done(); }), persistTasks.end());
+		const FilePath dir = Format(L"{}cache/"_fmt, document);
+		FileSystem::CreateDirectories(dir);
+		const uint32 last = std::min(first + warmCachePages, numPages);
+		Array<FilePath> keep;
+		for (uint32 i = first; i < last; i++) {
+			keep.push_back(FileSystem::FullPath(getCachePath(i)));
+		}
+		// 書き込み中のものを消さないよう、古いキャッシュは保存を始める前に消す
+		for (const auto& file : FileSystem::DirectoryContents(dir, false)) {
+			if (std::find(keep.begin(), keep.end(), FileSystem::FullPath(file)) == keep.end()) {
+				FileSystem::Remove(file);
+			}
+		}
+		for (uint32 i = first; i < last; i++) {
+			const FilePath cache = getCachePath(i);
+			if (FileSystem::Exists(cache) && readImageSize(cache) == ringSize) continue;
+			// 閉じた後に走るので、sequenceReader など開いている文書の状態は使わない
+			const FilePath doc = document, source = getPagePath(i);
+			const Size size = ringSize;
+			persistTasks.push_back(concurrency::create_task([doc, i, source, cache, size]() {
+				Image image;
+				if (!sharedcache::get(doc, i, size, image)) {
+					image = decodePage(doc, i, source, 0);
+					if (image && image.size != size) image.scale(size.x, size.y);
+				}
+				if (image) atomicfile::save(image, cache);
+			}));
+		}
+	}
+
+	void resetStats() {
+		numHits = 0;
+		numMisses = 0;
+		numEvicted = 0;
+		sequenceReader.resetStats();
+	}
+
+	// ページが入っている部分だけを返す
+	TextureRegion getPage(int i) {
+		if (!isLoaded(i)) {
+			return TextureRegion(nullPage);
+		}
+		const Slot& s = slots[resolve(i)];
+		return ring[s.ring](0, 0, s.size.x, s.size.y);
+	}
+}
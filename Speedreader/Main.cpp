@@ -1,592 +1,1041 @@
-﻿#include <Siv3D.hpp>
-#include <HamFramework.hpp>
-#include "Main.h"
-#include "Loader.hpp"
-
-#ifdef DEPLOY
-String currentDocument(L"./doc/");
-String configFile(L"./speedreader.ini");
-String sampleDocument(L"./sample/");
-#else
-String currentDocument(L"../Speedreader/speedreader/doc/");
-String configFile(L"../Speedreader/speedreader.ini");
-String sampleDocument(L"../Speedreader/speedreader/sample/");
-#endif
-
-struct CommonData {
-};
-
-enum class sceneName {
-	LoadPages,
-	DisplayPages,
-	DisplaySinglePage,
-	DisplayBooks,
-};
-
-
-std::wstring displayOrder(L"LTR"); // Right to left(RTL): 0 LTR: 1
-double joystickPointerSpeed = 1.0;
-int drawingXOffset = 100;
-double viewingPage = 0;
-int numPageVertical = 1;
-int autoplaySpeed = 0;
-int debugTexureLoadingBenchmark;
-int numPages;
-XInput controller = XInput(0);
-Vec2 pos;
-double invFPS;
-Font font10;
-SceneManager<sceneName, CommonData> sceneManager;
-
-
-int progressBarWidth = 20;
-
-int infoPaneLeft = progressBarWidth + 2;
-int infoPaneTop = 20;
-int infoPaneSlotHeight = 20;
-enum class infoPaneSlot {
-	FPS,
-	Mode,
-	IsAutoPlay,
-	AutoSpeed,
-};
-
-void infoPaneDraw(DrawableString s, infoPaneSlot y) {
-	s.draw(infoPaneLeft, infoPaneSlotHeight * static_cast<int>(y) + infoPaneTop);
-}
-
-
-void loadPDFConfig() {
-	String filename = Format(currentDocument, L"config.ini");
-	INIReader ini(filename);
-	if (!ini)
-	{
-		INIWriter default_ini(filename);
-		default_ini.write(L"displayOrder", L"LTR");
-		ini = INIReader(filename);
-	}
-	displayOrder = ini.getOr<std::wstring>(L"displayOrder", L"LTR");
-}
-
-void savePDFConfig() {
-	String filename = Format(currentDocument, L"config.ini");
-	INIWriter default_ini(filename);
-	default_ini.write(L"displayOrder", displayOrder);
-}
-
-void reverseDisplayOrder() {
-	if (displayOrder == L"LTR") {
-		displayOrder = L"RTL";
-	}
-	else {
-		displayOrder = L"LTR";
-	}
-}
-
-void updateConfig(INIReader	config) {
-	config.reload();
-	joystickPointerSpeed = config.getOr<double>(L"Controller.PointerSpeed", 1.0);
-	drawingXOffset = config.getOr<int>(L"Drawing.XOffset", 100);
-	debugTexureLoadingBenchmark = config.getOr<int>(L"Debug.TextureLoadingBenchmark", 0);
-}
-
-void loadNewDocument(String path) {
-	currentDocument = path;
-	Profiler::EnableWarning(false); // 再読み込み時のテクスチャ破棄で警告されるので読み終わるまでdisable
-	loadPDFConfig();
-	viewingPage = 0;
-	numPageVertical = 1;
-	loader::loadPDF(currentDocument);
-	numPages = loader::numPages;
-	sceneManager.changeScene(sceneName::LoadPages, 0, false);
-}
-
-void convertToDDS() {
-	// TODO: make menu to call this
-	for (auto i : step(100)) {
-		Image(
-			Format(L"C:/Users/nishio/Desktop/images/pages_{:04d}.png"_fmt, i + 1)
-		).save(
-			Format(L"C:/Users/nishio/Desktop/images/pages_{:04d}.dds"_fmt, i + 1)
-		);
-	}
-}
-
-int numDisplayingPages = 1;
-void drawPages() {
-	int ipage = static_cast<int>(viewingPage) % numPages;
-	Texture t = loader::getPage(ipage);
-	double h = static_cast<double>(t.height);
-	double w = static_cast<double>(t.width);
-
-	int screenHeight = Window::Height();
-	double pageHeight = screenHeight, pageWidth = w / h * pageHeight;
-
-	//int numPageHorizontal = displayMode * horizontalMultiplier;
-	int numPageHorizontal = static_cast<int>((Window::Width() - drawingXOffset) * numPageVertical / pageWidth); // 右に余白を作らず描けるだけ描く
-	pageHeight /= numPageVertical;
-	pageWidth /= numPageVertical;
-	// Tile mode
-	if (displayOrder == L"LTR") {
-		for (int y = 0; y < numPageVertical; y++) {
-			for (int x = 0; x < numPageHorizontal; x++) {
-				int i = ipage + y * numPageHorizontal + x;
-				loader::getPage(i)
-					.resize(pageWidth, pageHeight)
-					.draw(drawingXOffset + pageWidth * x, pageHeight * y);
-
-			}
-		}
-	}
-	else {
-		for (int y = 0; y < numPageVertical; y++) {
-			for (int x = 0; x < numPageHorizontal; x++) {
-				int i = ipage + y * numPageHorizontal + x;
-				loader::getPage(i)
-					.resize(pageWidth, pageHeight)
-					.draw(drawingXOffset + pageWidth * (numPageHorizontal - x - 1), pageHeight * y);
-
-			}
-		}
-	}
-	numDisplayingPages = numPageVertical * numPageHorizontal;
-}
-
-class DisplayPages : public SceneManager<sceneName, CommonData>::Scene
-{
-public:
-	void init() override
-	{
-
-	}
-
-	void update() override
-	{
-		viewingPage -= pow(controller.leftTrigger, 2);
-		viewingPage += pow(controller.rightTrigger, 2);
-
-		viewingPage += controller.rightThumbY / 5;  // slow
-
-													// キーでのパラパラめくり// 早送り巻き戻しメタファー
-		const int initial_speed = 4; // 秒間1ページなどの低速で自動送りしたいケースがなかったので最初から連打より速めに設定
-		if (Input::KeyRight.clicked) {
-			if (autoplaySpeed > 0) {
-				autoplaySpeed *= 2;
-			}
-			else if (autoplaySpeed == 0) {
-				autoplaySpeed = initial_speed;
-			}
-			else {
-				autoplaySpeed = 0;
-			}
-		}
-		if (Input::KeyLeft.clicked) {
-			if (autoplaySpeed < 0) {
-				autoplaySpeed *= 2;
-			}
-			else if (autoplaySpeed == 0) {
-				autoplaySpeed = -initial_speed;
-			}
-			else {
-				autoplaySpeed = 0;
-			}
-		}
-
-		// 表示されているページ分だけまとめて進める
-		if (controller.buttonA.clicked || Input::KeyDown.clicked) {
-			viewingPage += numDisplayingPages;
-			autoplaySpeed = 0;
-		}
-		if (controller.buttonB.clicked || Input::KeyUp.clicked) {
-			viewingPage -= numDisplayingPages;
-			autoplaySpeed = 0;
-		}
-
-		// Shift+Up/Downで1ページだけ前後する
-		if ((Input::KeyDown + Input::KeyShift).clicked) {
-			viewingPage++;
-			autoplaySpeed = 0;
-		}
-		if ((Input::KeyUp + Input::KeyShift).clicked) {
-			viewingPage--;
-			autoplaySpeed = 0;
-		}
-
-		if (autoplaySpeed) {
-			viewingPage += autoplaySpeed * invFPS / 1000;
-		}
-
-		// Xボタンorクリックでそのページを通常表示
-		if (controller.buttonX.clicked || Input::MouseL.clicked) {
-			int ipage = static_cast<int>(viewingPage) % numPages;
-			Texture t = loader::getPage(ipage);
-			double h = static_cast<double>(t.height);
-			double w = static_cast<double>(t.width);
-
-			int screenHeight = Window::Height();
-			double pageHeight = screenHeight, pageWidth = w / h * pageHeight;
-			int numPageHorizontal = static_cast<int>((Window::Width() - drawingXOffset) * numPageVertical / pageWidth); // 右に余白を作らず描けるだけ描く
-			pageHeight /= numPageVertical;
-			pageWidth /= numPageVertical;
-
-			if (Input::MouseL.clicked) {
-				pos = Mouse::Pos();
-			}
-			int x = static_cast<int>((pos.x - drawingXOffset) / pageWidth);
-			if (displayOrder != L"LTR") {
-				x = numPageHorizontal - x - 1;
-			}
-			int y = static_cast<int>(pos.y / pageHeight);
-			viewingPage = ipage + x + y * numPageHorizontal;
-			numPageVertical = 1;
-			Cursor::SetPos(0, 0);
-			pos = { 0, 0 };
-		}
-
-		// 最初・最後のページで前後に移動した時に反対側に飛ぶべきかどうか、今disabled
-		//if (page < 0) page += numPages;
-		//if (page > numPages - 1) page = 0;
-		if (viewingPage < 0) viewingPage = 0;
-		if (viewingPage > numPages - 1) viewingPage = numPages - 1;
-
-		// まだ読み終わってなければ順次ロード
-		loader::keepLoading();
-
-	}
-
-	void draw() const override
-	{
-		infoPaneDraw(font10(L"DisplayPages"), infoPaneSlot::Mode);
-		if (autoplaySpeed) {
-			infoPaneDraw(font10(L"自動再生: "), infoPaneSlot::IsAutoPlay);
-			infoPaneDraw(font10(autoplaySpeed), infoPaneSlot::AutoSpeed);
-		}
-		// draw progress bar
-		int numberLeft = 2;
-		int numberVOffset = 2;
-		int screenHeight = Window::Height();
-		Rect(0, 0, progressBarWidth, screenHeight).draw(Color(200));
-		int ipage = static_cast<int>(viewingPage) % numPages;
-
-		Rect(numberLeft, 0,
-			16, screenHeight * (ipage + 1) / numPages).draw(Color(100));
-		font10(ipage + 1).draw(numberLeft, numberVOffset);
-
-		const int32 h2 = font10(numPages).region().h;
-		font10(numPages).draw(numberLeft, screenHeight - h2 - numberVOffset);
-
-		drawPages();
-	}
-};
-
-
-
-class DisplaySinglePage : public SceneManager<sceneName, CommonData>::Scene
-{
-public:
-	void init() override
-	{
-
-	}
-
-	void update() override
-	{
-		if (controller.buttonA.clicked || Input::KeyDown.clicked) viewingPage += 0.5;
-		if (controller.buttonB.clicked || Input::KeyUp.clicked) viewingPage -= 0.5;
-	}
-
-	void draw() const override
-	{
-		// Zoom-in mode
-		// いま2倍に拡大して半分ずつ表示する実装だが、もっとズームインしたり平行移動したりできた方がよいのではないか
-		int ipage = static_cast<int>(viewingPage) % numPages;
-		Texture t = loader::getPage(ipage);
-		double h = static_cast<double>(t.height);
-		double w = static_cast<double>(t.width);
-		int screenHeight = Window::Height();
-		double pageHeight = screenHeight, pageWidth = w / h * pageHeight;
-
-
-		int scale = 2;
-		if (static_cast<int>(viewingPage * 2) % 2 == 0) {
-			t.resize(pageWidth * scale, pageHeight * scale).draw(drawingXOffset, 0);
-		}
-		else {
-			t(0, h / 2, w, h / 2).resize(pageWidth * scale, pageHeight).draw(drawingXOffset, 0);
-		}
-	}
-};
-
-class LoadPages : public SceneManager<sceneName, CommonData>::Scene
-{
-public:
-	void init() override
-	{
-	}
-
-	void update() override
-	{
-		if (controller.buttonA.clicked || Input::KeyDown.clicked) {
-			numPageVertical = 1;
-			sceneManager.changeScene(sceneName::DisplayPages, 0, false);
-		}
-
-		// まだ読み終わってなければ順次ロード
-		loader::keepLoading();
-		// ロード中のページが画面に収まらないならズームアウトする
-		if (loader::loadingPage > numDisplayingPages) {
-			numPageVertical++;
-		}
-	}
-
-	void draw() const override
-	{
-		infoPaneDraw(font10(L"Loading"), infoPaneSlot::Mode);
-		drawPages();
-	}
-};
-
-class DisplayBooks : public SceneManager<sceneName, CommonData>::Scene
-{
-public:
-	Array<FilePath> pathToBookImages;
-	Array<Texture> bookImages;
-	Array<FilePath> pathToBooks;
-	uint32 viewingBooks = 0;
-	int numBooks = 0;
-
-	void init() override
-	{
-		viewingPage = 0;
-		numPageVertical = 5;
-		Array<FilePath> contents = FileSystem::DirectoryContents(
-			L"C:/Users/nishio/Desktop/books");
-
-		for (const auto& content : contents)
-		{
-			if (FileSystem::IsDirectory(content))
-			{
-				auto path = Format(L"{}/cover.png"_fmt, content);
-				if (!FileSystem::Exists(path)) {
-					path = Format(L"{}/pages_0001.png"_fmt, content);
-				}
-				if (!FileSystem::Exists(path)) {
-					path = Format(L"{}/page-001.png"_fmt, content);
-				}
-				if (FileSystem::Exists(path)) {
-					pathToBookImages.push_back(path);
-					pathToBooks.push_back(content);
-				}
-			}
-		}
-		numBooks = pathToBookImages.size();
-		bookImages.resize(numBooks);
-		for (int i = 0; i < numBooks; i++) {
-			bookImages[i] = Texture(pathToBookImages[i]);
-		}
-		viewingPage = 0;
-		numPages = pathToBookImages.size(); // 本当はこのシーンに遷移するタイミングでこの代入が行われるべきなのだけどやってない
-	}
-
-	void update() override
-	{
-		// 表示されているページ分だけまとめて進める
-		if (controller.buttonA.clicked || Input::KeyDown.clicked) {
-			viewingBooks += numDisplayingPages;
-			autoplaySpeed = 0;
-		}
-		if (controller.buttonB.clicked || Input::KeyUp.clicked) {
-			viewingBooks -= numDisplayingPages;
-			autoplaySpeed = 0;
-		}
-
-		// Xボタンorクリックでそのページを通常表示
-		if (controller.buttonX.clicked || Input::MouseL.clicked) {
-			Texture t = getBook(viewingBooks);
-			double h = static_cast<double>(t.height);
-			double w = static_cast<double>(t.width);
-
-			int screenHeight = Window::Height();
-			double pageHeight = screenHeight, pageWidth = w / h * pageHeight;
-			int numPageHorizontal = static_cast<int>((Window::Width() - drawingXOffset) * numPageVertical / pageWidth); // 右に余白を作らず描けるだけ描く
-			pageHeight /= numPageVertical;
-			pageWidth /= numPageVertical;
-
-			if (Input::MouseL.clicked) {
-				pos = Mouse::Pos();
-			}
-			int x = static_cast<int>((pos.x - drawingXOffset) / pageWidth);
-			if (displayOrder != L"LTR") {
-				x = numPageHorizontal - x - 1;
-			}
-			int y = static_cast<int>(pos.y / pageHeight);
-			uint32 iBook = viewingBooks + x + y * numPageHorizontal;
-			if (iBook < pathToBooks.size()) {
-				loadNewDocument(pathToBooks[iBook]);
-			}
-			Cursor::SetPos(0, 0);
-			pos = { 0, 0 };
-		}
-
-	}
-
-	void draw() const override
-	{
-		infoPaneDraw(font10(L"DisplayBooks"), infoPaneSlot::Mode);
-
-		int ipage = static_cast<int>(viewingPage) % numPages;
-		Texture t = bookImages[ipage];
-		double h = static_cast<double>(t.height);
-		double w = static_cast<double>(t.width);
-
-		int screenHeight = Window::Height();
-		double pageHeight = screenHeight / numPageVertical;
-		double pageWidth = pageHeight; // 横長のPDFもあるので枠は正方形にする
-		int numPageHorizontal = static_cast<int>((Window::Width() - drawingXOffset)  / pageWidth); // 右に余白を作らず描けるだけ描く
-																								   // Tile mode
-		for (int y = 0; y < numPageVertical; y++) {
-			for (int x = 0; x < numPageHorizontal; x++) {
-				int i = ipage + y * numPageHorizontal + x;
-				Texture book = getBook(i);
-				h = static_cast<double>(book.height);
-				w = static_cast<double>(book.width);
-				double ox, oy;
-				if (h > w) {
-					w = pageWidth * w / h;
-					h = pageWidth;
-					oy = 0;
-					ox = (pageWidth - w) / 2;
-				}
-				else {
-					h = pageWidth * h / w;
-					w = pageWidth;
-					ox = 0;
-					oy = (pageWidth - h) / 2;
-				}
-				book.resize(w, h)
-					.draw(drawingXOffset + pageWidth * x + ox, pageHeight * y + oy);
-
-			}
-		}
-		numDisplayingPages = numPageVertical * numPageHorizontal;
-
-	}
-
-	const Texture& getBook(uint32 i) const {
-		if (i < bookImages.size()) {
-			return bookImages[i];
-		}
-		else {
-			return nullPage;
-		}
-	}
-	Texture nullPage;
-};
-
-void Main()
-{
-	sceneManager.add<DisplayBooks>(sceneName::DisplayBooks);
-	sceneManager.add<DisplaySinglePage>(sceneName::DisplaySinglePage);
-	sceneManager.add<DisplayPages>(sceneName::DisplayPages);
-	sceneManager.add<LoadPages>(sceneName::LoadPages);
-	sceneManager.changeScene(sceneName::DisplayBooks, 0, false);
-	INIReader config(configFile);
-	updateConfig(config);
-
-	const Font font(30);
-	font10 = Font(10);
-
-	Window::SetTitle(L"Speedreader");
-	Window::Resize(1300, 700);
-	Window::ToUpperLeft();
-	Window::SetStyle(WindowStyle::Sizeable);
-
-	Cursor::SetPos(0, 0);
-
-	Stopwatch stopwatch(true);
-
-	// ESCでWindowを閉じない
-	System::SetExitEvent(WindowEvent::CloseButton);
-
-	controller.setLeftTriggerDeadZone();
-	controller.setRightTriggerDeadZone();
-	controller.setLeftThumbDeadZone();
-	controller.setRightThumbDeadZone();
-
-	double msecFromLastFPSUpdate = 0;
-	int FPS;
-	while (System::Update())
-	{
-		invFPS = stopwatch.ms();
-		msecFromLastFPSUpdate += invFPS;
-		if (msecFromLastFPSUpdate > 250) {
-			FPS = static_cast<int>(1000.0 / invFPS);
-			msecFromLastFPSUpdate = 0;
-		}
-
-		infoPaneDraw(font10(L"FPS: ", FPS), infoPaneSlot::FPS);
-		stopwatch.restart();
-
-		if (config.hasChanged()) updateConfig(config);
-
-		if (Dragdrop::HasItems())
-		{
-			const Array<FilePath> items = Dragdrop::GetFilePaths();
-			loadNewDocument(items[0]);
-		}
-
-
-		pos += Vec2(
-			controller.leftThumbX * joystickPointerSpeed * invFPS, 
-			-controller.leftThumbY * joystickPointerSpeed * invFPS);
-		//pos += Mouse::Delta();  // マウスも併用する場合はジョイスティックでの移動差分をマウスの入力と勘違いするので用修正
-		if (pos.x < 0) pos.x = 0;
-		if (pos.y < 0) pos.y = 0;
-		if (pos.x > Window::Width()) pos.x = Window::Width();
-		if (pos.y > Window::Height()) pos.y = Window::Height();
-
-		sceneManager.update();
-
-		if (controller.buttonLB.clicked || Input::KeyZ.clicked) {
-			numPageVertical--;
-			if (numPageVertical == 0) {
-				sceneManager.changeScene(sceneName::DisplaySinglePage, 0, false);
-			}
-		}
-		if (controller.buttonRB.clicked || Input::KeyC.clicked) {
-			numPageVertical++;
-			if (numPageVertical == 1) {
-				sceneManager.changeScene(sceneName::DisplayPages, 0, false);
-			}
-		}
-
-		/*
-		int ipage = static_cast<int>(viewingPage) % numPages;
-		Texture t = loader::getPage(ipage);
-		double h = static_cast<double>(t.height);
-		double w = static_cast<double>(t.width);
-		//const int screenHeight = 640;
-		int screenHeight = Window::Height();
-		double pageHeight = screenHeight, pageWidth = w / h * pageHeight;
-
-		int horizontalMultiplier = 2; // 見開きにするなら2、しないなら1
-		if (h < w) horizontalMultiplier = 1;
-
-		*/
-
-		sceneManager.draw();
-
-
-		// 書籍一覧
-		if (controller.buttonY.clicked || Input::KeyX.clicked) {
-			sceneManager.changeScene(sceneName::DisplayBooks, 0, false);
-		}
-
-		if (Input::KeyR.clicked) {
-			reverseDisplayOrder();
-		}
-
-		// カーソル表示
-		Circle(pos, 10).draw({ 255, 255, 0, 127 });
-	}
-}
+#include <Siv3D.hpp>
+#include <HamFramework.hpp>
+#include "Main.h"
+#include "Loader.hpp"
+#include "Replay.hpp"
+#include "TiledPage.hpp"
+#include "Thumbnails.hpp"
+#include "Governor.hpp"
+#include "Ingest.hpp"
+#include "Startup.hpp"
+#include "Layout.hpp"
+
+#ifdef DEPLOY
+String currentDocument(L"./doc/");
+String configFile(L"./speedreader.ini");
+String sampleDocument(L"./sample/");
+#else
+String currentDocument(L"../Speedreader/speedreader/doc/");
+String configFile(L"../Speedreader/speedreader.ini");
+String sampleDocument(L"../Speedreader/speedreader/sample/");
+#endif
+String libraryDirectory(L"C:/Users/nishio/Desktop/books");
+
+struct CommonData {
+};
+
+enum class sceneName {
+	LoadPages,
+	DisplayPages,
+	DisplaySinglePage,
+	DisplayBooks,
+	DisplayLibrary,
+};
+
+
+std::wstring displayOrder(L"LTR"); // Right to left(RTL): 0 LTR: 1
+double joystickPointerSpeed = 1.0;
+int drawingXOffset = 100;
+double viewingPage = 0;
+int numPageVertical = 1;
+int autoplaySpeed = 0;
+int minNumPageVertical = -3; // 拡大の限界。-3で16倍
+int zoomTileCacheSize = 96;
+double zoomPanSpeed = 0.001;
+int debugTexureLoadingBenchmark;
+int numPages;
+int numDisplayingPages = 1;
+layout::Grid pageGrid; // 今の画面に並べたページ。クリックやポインタの位置と、先読みする範囲をここから引く
+bool documentOpen = false;
+bool persistReadingState = true; // 再生中は前回の位置やキャッシュに結果が左右されないよう保存しない
+XInput controller = XInput(0);
+replay::InputFrame input; // このフレームの入力(ライブまたは再生)
+using replay::Button;
+int numBlankPages = 0; // このフレームで未ロードのまま描いたページ数
+Vec2 pos;
+double invFPS;
+Font font10;
+SceneManager<sceneName, CommonData> sceneManager;
+
+
+int progressBarWidth = 20;
+
+int infoPaneLeft = progressBarWidth + 2;
+int infoPaneTop = 20;
+int infoPaneSlotHeight = 20;
+enum class infoPaneSlot {
+	FPS,
+	Mode,
+	IsAutoPlay,
+	AutoSpeed,
+	Memory,
+	Dedup,
+	SharedCache,
+};
+
+void infoPaneDraw(DrawableString s, infoPaneSlot y) {
+	s.draw(infoPaneLeft, infoPaneSlotHeight * static_cast<int>(y) + infoPaneTop);
+}
+
+
+void loadPDFConfig() {
+	String filename = Format(currentDocument, L"config.ini");
+	INIReader ini(filename);
+	if (!ini)
+	{
+		INIWriter default_ini(filename);
+		default_ini.write(L"displayOrder", L"LTR");
+		ini = INIReader(filename);
+	}
+	displayOrder = ini.getOr<std::wstring>(L"displayOrder", L"LTR");
+	// 前回閉じたときの位置と倍率
+	viewingPage = ini.getOr<double>(L"viewingPage", 0);
+	numPageVertical = ini.getOr<int>(L"numPageVertical", 1);
+}
+
+void savePDFConfig() {
+	String filename = Format(currentDocument, L"config.ini");
+	INIWriter default_ini(filename);
+	default_ini.write(L"displayOrder", displayOrder);
+	if (persistReadingState) {
+		default_ini.write(L"viewingPage", viewingPage);
+		default_ini.write(L"numPageVertical", numPageVertical);
+		loader::persistWarmCache(static_cast<uint32>(viewingPage));
+	}
+}
+
+void reverseDisplayOrder() {
+	if (displayOrder == L"LTR") {
+		displayOrder = L"RTL";
+	}
+	else {
+		displayOrder = L"LTR";
+	}
+}
+
+void updateConfig(INIReader	config) {
+	config.reload();
+	joystickPointerSpeed = config.getOr<double>(L"Controller.PointerSpeed", 1.0);
+	drawingXOffset = config.getOr<int>(L"Drawing.XOffset", 100);
+	debugTexureLoadingBenchmark = config.getOr<int>(L"Debug.TextureLoadingBenchmark", 0);
+	zoomTileCacheSize = config.getOr<int>(L"Drawing.ZoomTileCache", 96);
+	zoomPanSpeed = config.getOr<double>(L"Controller.ZoomPanSpeed", 0.001);
+	libraryDirectory = config.getOr<String>(L"Library.Directory", libraryDirectory);
+	thumbnail::height = config.getOr<int>(L"Library.ThumbnailHeight", 64);
+	thumbnail::budget = config.getOr<int>(L"Library.ThumbnailBudget", 4000);
+	thumbnail::coverHeight = config.getOr<int>(L"Library.CoverHeight", 256);
+	governor::processHighWatermark = config.getOr<uint64>(L"Memory.ProcessHighWatermarkMB", 2048) << 20;
+	governor::processLowWatermark = config.getOr<uint64>(L"Memory.ProcessLowWatermarkMB", 1536) << 20;
+	governor::minSystemFree = config.getOr<uint64>(L"Memory.MinSystemFreeMB", 256) << 20;
+	governor::maxLevel = config.getOr<int>(L"Memory.MaxLevel", 2);
+	loader::ringBaseSize = Size(config.getOr<int>(L"Loader.PageWidth", 1200), config.getOr<int>(L"Loader.PageHeight", 1600));
+	loader::ringSlots = std::max(2, config.getOr<int>(L"Loader.RingSlots", 64));
+	bands::writeOnDecode = config.getOr<int>(L"Loader.WriteBands", 1) != 0;
+	bands::minPixels = config.getOr<int>(L"Loader.BandMinPixels", 2000 * 2000);
+	bands::maxPendingWrites = config.getOr<int>(L"Loader.MaxPendingBandWrites", 2);
+	loader::useDedup = config.getOr<int>(L"Loader.Dedup", 1) != 0;
+	loader::useSequence = config.getOr<int>(L"Loader.Sequence", 1) != 0;
+	sequence::maxSteps = config.getOr<int>(L"Loader.SequenceMaxSteps", 16);
+}
+
+double zoomScale() {
+	return 2 << -std::min(0, numPageVertical);
+}
+
+// 記録・再生の設定。起動時に一度だけ読む
+String replayRecordPath;
+String replaySource; // 録画ファイルのパス、標準シナリオ名、または All
+String replayDocument;
+String replayReportPath;
+
+
+// 開いている文書の位置を保存して閉じる
+void closeDocument() {
+	if (documentOpen) {
+		savePDFConfig();
+		documentOpen = false;
+	}
+}
+
+// startPage を省略すると前回の位置から開く。ページが1枚もなければ開かずに今の画面に残る
+void loadNewDocument(String path, int startPage = -1) {
+	if (loader::countPages(path) == 0) {
+		Log << L"no pages in " << path;
+		return;
+	}
+	closeDocument();
+	currentDocument = path;
+	loadPDFConfig();
+	if (startPage >= 0 || !persistReadingState) {
+		viewingPage = std::max(0, startPage);
+		numPageVertical = 1;
+	}
+	loader::loadPDF(currentDocument, static_cast<uint32>(viewingPage));
+	numPages = loader::numPages;
+	documentOpen = true;
+	// 読み途中の文書はロード画面を挟まずその位置を出す
+	if (viewingPage == 0 && numPageVertical == 1) {
+		sceneManager.changeScene(sceneName::LoadPages, 0, false);
+	}
+	else if (numPageVertical <= 0) {
+		sceneManager.changeScene(sceneName::DisplaySinglePage, 0, false);
+	}
+	else {
+		sceneManager.changeScene(sceneName::DisplayPages, 0, false);
+	}
+}
+
+// 書籍置き場の直下にある書籍のディレクトリ。thumbs/ などの下までは見ない
+Array<FilePath> listBooks(const FilePath& library = libraryDirectory) {
+	Array<FilePath> books;
+	for (const auto& content : FileSystem::DirectoryContents(library, false)) {
+		if (FileSystem::IsDirectory(content)) {
+			books.push_back(content);
+		}
+	}
+	return books;
+}
+
+String bookName(const FilePath& dir) {
+	std::wstring s = dir.str();
+	while (!s.empty() && (s.back() == L'/' || s.back() == L'\\')) {
+		s.pop_back();
+	}
+	return s.substr(s.find_last_of(L"/\\") + 1);
+}
+
+// Speedreader.exe --ingest で起動したときは取り込みだけをして終わる。進み具合はウィンドウに出す
+void runIngest(const FilePath& source, const FilePath& output, INIReader& config) {
+	ingest::Options options;
+	options.sourceRoot = source;
+	options.outputRoot = output;
+	options.pageHeight = config.getOr<int>(L"Ingest.PageHeight", 0);
+	options.dpi = config.getOr<int>(L"Ingest.DPI", 300);
+	options.ghostscript = config.getOr<String>(L"Ingest.Ghostscript", L"gswin64c");
+	options.queueCapacity = config.getOr<int>(L"Ingest.QueueCapacity", 16);
+	options.perceptualDedup = config.getOr<int>(L"Ingest.PerceptualDedup", -1);
+	options.writeSequence = config.getOr<int>(L"Ingest.Sequence", 0) != 0;
+	options.sequenceHeight = config.getOr<int>(L"Ingest.SequenceHeight", 1600);
+	options.zoomTiles = config.getOr<int>(L"Ingest.ZoomTiles", 0) != 0;
+	options.renderChunk = config.getOr<uint32>(L"Ingest.RenderChunk", 16);
+
+	Window::SetTitle(L"Speedreader - ingest");
+	const Font font(12);
+	ingest::Pipeline pipeline(options);
+	pipeline.start();
+	while (!pipeline.progress.finished) {
+		if (!System::Update()) {
+			pipeline.cancel();
+			break;
+		}
+		font(L"ingest: ", source, L" -> ", output).draw(10, 10);
+		font(pipeline.summary()).draw(10, 40);
+	}
+	pipeline.join();
+
+	TextWriter report(Format(L"{}/ingest_report.txt"_fmt, output), OpenMode::Append);
+	report.writeln(DateTime::Now(), L" ", source, L" ", pipeline.summary());
+	Log << L"ingest: " << pipeline.summary();
+}
+
+// 表示中のページ番号。文書を開いていないときは0
+int viewingPageIndex() {
+	return numPages > 0 ? static_cast<int>(viewingPage) % numPages : 0;
+}
+
+void drawPages() {
+	if (numPages <= 0) return;
+	int ipage = viewingPageIndex();
+	// 表示中のページがまだ読めていなくても枠が決まるよう、最初に読んだページの大きさを使う
+	double h = static_cast<double>(loader::pageSize.y);
+	double w = static_cast<double>(loader::pageSize.x);
+
+	int screenHeight = Window::Height();
+	double pageHeight = screenHeight, pageWidth = w / h * pageHeight;
+
+	//int numPageHorizontal = displayMode * horizontalMultiplier;
+	int numPageHorizontal = static_cast<int>((Window::Width() - drawingXOffset) * numPageVertical / pageWidth); // 右に余白を作らず描けるだけ描く
+	pageHeight /= numPageVertical;
+	pageWidth /= numPageVertical;
+	// Tile mode
+	pageGrid.set(Vec2(drawingXOffset, 0), Vec2(pageWidth, pageHeight), numPageHorizontal, numPageVertical,
+		ipage, numPages, displayOrder != L"LTR");
+	for (int i = pageGrid.begin(); i < pageGrid.end(); i++) {
+		if (!loader::isLoaded(i)) numBlankPages++;
+		const RectF r = pageGrid.rect(i);
+		loader::getPage(i)
+			.resize(r.w, r.h)
+			.draw(r.x, r.y);
+	}
+	// ポインタの下のページ
+	const int hovered = pageGrid.at(pos);
+	if (hovered >= 0) {
+		pageGrid.rect(hovered).drawFrame(0, 2, Color(255, 255, 0, 127));
+	}
+	numDisplayingPages = numPageVertical * numPageHorizontal;
+}
+
+class DisplayPages : public SceneManager<sceneName, CommonData>::Scene
+{
+public:
+	void init() override
+	{
+
+	}
+
+	void update() override
+	{
+		viewingPage -= pow(input.leftTrigger, 2);
+		viewingPage += pow(input.rightTrigger, 2);
+
+		viewingPage += input.rightThumbY / 5;  // slow
+
+													// キーでのパラパラめくり// 早送り巻き戻しメタファー
+		const int initial_speed = 4; // 秒間1ページなどの低速で自動送りしたいケースがなかったので最初から連打より速めに設定
+		if (input.clicked(Button::KeyRight)) {
+			if (autoplaySpeed > 0) {
+				autoplaySpeed *= 2;
+			}
+			else if (autoplaySpeed == 0) {
+				autoplaySpeed = initial_speed;
+			}
+			else {
+				autoplaySpeed = 0;
+			}
+		}
+		if (input.clicked(Button::KeyLeft)) {
+			if (autoplaySpeed < 0) {
+				autoplaySpeed *= 2;
+			}
+			else if (autoplaySpeed == 0) {
+				autoplaySpeed = -initial_speed;
+			}
+			else {
+				autoplaySpeed = 0;
+			}
+		}
+
+		// 表示されているページ分だけまとめて進める
+		if (input.clicked(Button::A) || input.clicked(Button::KeyDown)) {
+			viewingPage += numDisplayingPages;
+			autoplaySpeed = 0;
+		}
+		if (input.clicked(Button::B) || input.clicked(Button::KeyUp)) {
+			viewingPage -= numDisplayingPages;
+			autoplaySpeed = 0;
+		}
+
+		// Shift+Up/Downで1ページだけ前後する
+		if (input.clicked(Button::ShiftDown)) {
+			viewingPage++;
+			autoplaySpeed = 0;
+		}
+		if (input.clicked(Button::ShiftUp)) {
+			viewingPage--;
+			autoplaySpeed = 0;
+		}
+
+		if (autoplaySpeed) {
+			viewingPage += autoplaySpeed * input.dt / 1000;
+		}
+
+		// Xボタンorクリックでそのページを通常表示
+		if (input.clicked(Button::X) || input.clicked(Button::MouseL)) {
+			if (input.clicked(Button::MouseL)) {
+				pos = input.mouse;
+			}
+			const int target = pageGrid.at(pos);
+			if (target >= 0) {
+				viewingPage = target;
+				numPageVertical = 1;
+			}
+			Cursor::SetPos(0, 0);
+			pos = { 0, 0 };
+		}
+
+		// 最初・最後のページで前後に移動した時に反対側に飛ぶべきかどうか、今disabled
+		//if (page < 0) page += numPages;
+		//if (page > numPages - 1) page = 0;
+		if (viewingPage < 0) viewingPage = 0;
+		if (viewingPage > numPages - 1) viewingPage = numPages - 1;
+
+		// まだ読み終わってなければ順次ロード
+		loader::keepLoading();
+
+	}
+
+	void draw() const override
+	{
+		infoPaneDraw(font10(L"DisplayPages"), infoPaneSlot::Mode);
+		if (autoplaySpeed) {
+			infoPaneDraw(font10(L"自動再生: "), infoPaneSlot::IsAutoPlay);
+			infoPaneDraw(font10(autoplaySpeed), infoPaneSlot::AutoSpeed);
+		}
+		// draw progress bar
+		int numberLeft = 2;
+		int numberVOffset = 2;
+		int screenHeight = Window::Height();
+		Rect(0, 0, progressBarWidth, screenHeight).draw(Color(200));
+		if (numPages <= 0) return;
+		int ipage = viewingPageIndex();
+
+		Rect(numberLeft, 0,
+			16, screenHeight * (ipage + 1) / numPages).draw(Color(100));
+		font10(ipage + 1).draw(numberLeft, numberVOffset);
+
+		const int32 h2 = font10(numPages).region().h;
+		font10(numPages).draw(numberLeft, screenHeight - h2 - numberVOffset);
+
+		drawPages();
+	}
+};
+
+
+
+class DisplaySinglePage : public SceneManager<sceneName, CommonData>::Scene
+{
+public:
+	// Zoom-in mode
+	// 倍率は numPageVertical で決まる(0で2倍、-1で4倍…)。縦位置は viewingPage の小数部で表す
+	zoom::TiledPage tiledPage;
+	double originX = 0; // 画面左端に来るページ内の横位置(0〜1)
+	RectF pageRect;
+	RectF viewport;
+	TextureRegion coarse;
+	TextureRegion nextPage;
+
+	void init() override
+	{
+		originX = 0;
+		tiledPage.maxTiles = zoomTileCacheSize;
+	}
+
+	void update() override
+	{
+		const double scale = zoomScale();
+		if (input.clicked(Button::A) || input.clicked(Button::KeyDown)) viewingPage += 1.0 / scale;
+		if (input.clicked(Button::B) || input.clicked(Button::KeyUp)) viewingPage -= 1.0 / scale;
+
+		// 右スティックと←/→で平行移動
+		viewingPage -= input.rightThumbY * zoomPanSpeed * input.dt / scale;
+		originX += input.rightThumbX * zoomPanSpeed * input.dt / scale;
+		if (input.clicked(Button::KeyRight)) originX += 0.5 / scale;
+		if (input.clicked(Button::KeyLeft)) originX -= 0.5 / scale;
+
+		if (viewingPage < 0) viewingPage = 0;
+		if (viewingPage > numPages - 1.0 / scale) viewingPage = numPages - 1.0 / scale;
+
+		// まだ読み終わってなければ順次ロード
+		loader::keepLoading();
+		if (numPages <= 0) return;
+
+		int ipage = viewingPageIndex();
+		coarse = loader::getPage(ipage);
+		nextPage = loader::getPage(ipage + 1);
+		// ring のTextureはどのページも同じ大きさなので、縦横比は pageSize から取る
+		double h = static_cast<double>(loader::pageSize.y);
+		double w = static_cast<double>(loader::pageSize.x);
+		double pageHeight = Window::Height() * scale, pageWidth = w / h * pageHeight;
+		viewport = RectF(drawingXOffset, 0, Window::Width() - drawingXOffset, Window::Height());
+
+		double maxOriginX = std::max(0.0, 1.0 - viewport.w / pageWidth);
+		originX = Clamp(originX, 0.0, maxOriginX);
+
+		double fraction = viewingPage - static_cast<int>(viewingPage);
+		pageRect = RectF(drawingXOffset - originX * pageWidth, -fraction * pageHeight, pageWidth, pageHeight);
+		// このページと、下に続けて描く次のページ
+		pageGrid.set(Vec2(pageRect.x, pageRect.y), Vec2(pageRect.w, pageRect.h), 1, 2, ipage, numPages);
+		if (!loader::isLoaded(ipage)) {
+			return;
+		}
+
+		const FilePath doc = loader::document, path = loader::getPagePath(ipage);
+		tiledPage.open(doc, ipage, [doc, ipage, path]() { return loader::decodePage(doc, ipage, path, 0); });
+		tiledPage.update(pageRect, viewport);
+	}
+
+	void draw() const override
+	{
+		infoPaneDraw(font10(L"DisplaySinglePage x", zoomScale()), infoPaneSlot::Mode);
+		if (numPages <= 0) return;
+		int ipage = viewingPageIndex();
+		if (!loader::isLoaded(ipage)) {
+			numBlankPages++;
+			return;
+		}
+		tiledPage.draw(coarse, pageRect, viewport);
+		// ページの下端が見えているときは次のページを続けて描く
+		if (pageRect.y + pageRect.h < viewport.h) {
+			nextPage.resize(pageRect.w, pageRect.h)
+				.draw(pageRect.x, pageRect.y + pageRect.h);
+		}
+	}
+};
+
+class LoadPages : public SceneManager<sceneName, CommonData>::Scene
+{
+public:
+	void init() override
+	{
+	}
+
+	void update() override
+	{
+		if (input.clicked(Button::A) || input.clicked(Button::KeyDown)) {
+			numPageVertical = 1;
+			sceneManager.changeScene(sceneName::DisplayPages, 0, false);
+		}
+
+		// まだ読み終わってなければ順次ロード
+		loader::keepLoading();
+		// ロード中のページが画面に収まらないならズームアウトする
+		if (loader::numLoaded() > numDisplayingPages) {
+			numPageVertical++;
+		}
+	}
+
+	void draw() const override
+	{
+		infoPaneDraw(font10(L"Loading"), infoPaneSlot::Mode);
+		drawPages();
+	}
+};
+
+class DisplayBooks : public SceneManager<sceneName, CommonData>::Scene
+{
+public:
+	// 書棚の走査は背景で行い、表紙はサムネイルのキャッシュから見えているものだけ読む。
+	// 起動直後は走査が終わるまで空の書棚を出して、ウィンドウの操作を待たせない
+	struct Shelf {
+		Array<FilePath> covers;
+		Array<FilePath> books;
+	};
+	Array<FilePath> pathToBookImages;
+	Array<FilePath> pathToBooks;
+	std::shared_ptr<Shelf> scanned;
+	concurrency::task<void> scanning;
+	bool shelfReady = false;
+	int viewingBooks = 0;
+	int numBooks = 0;
+	layout::Grid shelfGrid;
+
+	void init() override
+	{
+		viewingPage = 0;
+		numPageVertical = 5;
+		pathToBookImages.clear();
+		pathToBooks.clear();
+		numBooks = 0;
+		shelfReady = false;
+
+		auto shelf = std::make_shared<Shelf>();
+		scanned = shelf;
+		const FilePath library = libraryDirectory;
+		scanning = concurrency::create_task([shelf, library]() {
+			for (const auto& content : listBooks(library))
+			{
+				auto path = Format(L"{}/cover.png"_fmt, content);
+				if (!FileSystem::Exists(path)) {
+					path = Format(L"{}/pages_0001.png"_fmt, content);
+				}
+				if (!FileSystem::Exists(path)) {
+					path = Format(L"{}/page-001.png"_fmt, content);
+				}
+				if (FileSystem::Exists(path)) {
+					shelf->covers.push_back(path);
+					shelf->books.push_back(content);
+				}
+			}
+		});
+	}
+
+	void update() override
+	{
+		if (!shelfReady) {
+			if (!scanning.is_done()) return;
+			pathToBookImages = scanned->covers;
+			pathToBooks = scanned->books;
+			numBooks = pathToBooks.size();
+			viewingPage = 0;
+			numPages = numBooks; // 本当はこのシーンに遷移するタイミングでこの代入が行われるべきなのだけどやってない
+			shelfReady = true;
+			startup::milestone(L"library scanned");
+		}
+
+		// 表示されているページ分だけまとめて進める
+		if (input.clicked(Button::A) || input.clicked(Button::KeyDown)) {
+			viewingBooks += numDisplayingPages;
+			autoplaySpeed = 0;
+		}
+		if (input.clicked(Button::B) || input.clicked(Button::KeyUp)) {
+			viewingBooks -= numDisplayingPages;
+			autoplaySpeed = 0;
+		}
+		viewingBooks = Clamp(viewingBooks, 0, std::max(0, numBooks - 1));
+
+		// 枠は横長の書籍もあるので正方形。右に余白を作らず描けるだけ描く
+		const double cell = static_cast<double>(Window::Height()) / numPageVertical;
+		const int numPageHorizontal = static_cast<int>((Window::Width() - drawingXOffset) / cell);
+		shelfGrid.set(Vec2(drawingXOffset, 0), Vec2(cell, cell), numPageHorizontal, numPageVertical, viewingBooks, numBooks);
+		numDisplayingPages = shelfGrid.columns * shelfGrid.rows;
+
+		// Xボタンorクリックでその書籍を開く。表紙がまだ読めていなくても選べる
+		if (input.clicked(Button::X) || input.clicked(Button::MouseL)) {
+			if (input.clicked(Button::MouseL)) {
+				pos = input.mouse;
+			}
+			const int iBook = shelfGrid.at(pos);
+			if (iBook >= 0) {
+				loadNewDocument(pathToBooks[iBook]);
+			}
+			Cursor::SetPos(0, 0);
+			pos = { 0, 0 };
+		}
+
+	}
+
+	void draw() const override
+	{
+		infoPaneDraw(font10(L"DisplayBooks"), infoPaneSlot::Mode);
+		if (!shelfReady || numBooks == 0) {
+			infoPaneDraw(font10(shelfReady ? L"no books" : L"scanning library..."), infoPaneSlot::IsAutoPlay);
+			return;
+		}
+
+		bool complete = true;
+		// Tile mode
+		for (int i = shelfGrid.begin(); i < shelfGrid.end(); i++) {
+			const RectF cell = shelfGrid.rect(i);
+			const Texture& book = getBook(i);
+			if (!book) {
+				// 表紙のデコードが終わるまでは枠だけ描く
+				cell.stretched(-2).drawFrame(1, 0, Color(80));
+				complete = false;
+				continue;
+			}
+			double h = static_cast<double>(book.height);
+			double w = static_cast<double>(book.width);
+			double ox, oy;
+			if (h > w) {
+				w = cell.w * w / h;
+				h = cell.w;
+				oy = 0;
+				ox = (cell.w - w) / 2;
+			}
+			else {
+				h = cell.w * h / w;
+				w = cell.w;
+				ox = 0;
+				oy = (cell.w - h) / 2;
+			}
+			book.resize(w, h)
+				.draw(cell.x + ox, cell.y + oy);
+		}
+		// ポインタの下の書籍
+		const int hovered = shelfGrid.at(pos);
+		if (hovered >= 0) {
+			shelfGrid.rect(hovered).drawFrame(0, 2, Color(255, 255, 0, 127));
+		}
+		if (complete) {
+			startup::milestone(L"shelf complete");
+		}
+	}
+
+	const Texture& getBook(uint32 i) const {
+		if (i < pathToBooks.size()) {
+			return thumbnail::getCover(pathToBooks[i], pathToBookImages[i]);
+		}
+		else {
+			return nullPage;
+		}
+	}
+	Texture nullPage;
+};
+
+class DisplayLibrary : public SceneManager<sceneName, CommonData>::Scene
+{
+public:
+	// 全書籍のページを小さなサムネイルで1枚のモザイクに並べる。書籍ごとに行を改める
+	struct Book {
+		FilePath dir;
+		std::shared_ptr<uint32> numPages;
+		concurrency::task<void> counting;
+		uint32 firstRow = 0;
+		uint32 numRows = 1;
+	};
+	Array<Book> books;
+	layout::Intervals bookRows; // 行番号から書籍を二分探索するため
+	double scrollRow = 0;
+	int32 columns = 1;
+	int32 rowsOnScreen = 1;
+	uint32 totalRows = 0;
+
+	void init() override
+	{
+		books.clear();
+		for (const auto& dir : listBooks()) {
+			Book b;
+			b.dir = dir;
+			b.numPages = std::make_shared<uint32>(0);
+			auto n = b.numPages;
+			b.counting = concurrency::create_task([n, dir]() { *n = loader::countPages(dir); });
+			books.push_back(b);
+		}
+		scrollRow = 0;
+	}
+
+	int32 cellWidth() const {
+		return thumbnail::height * 3 / 4 + 2;
+	}
+
+	int32 cellHeight() const {
+		return thumbnail::height + 2;
+	}
+
+	void layout() {
+		columns = std::max(1, (Window::Width() - drawingXOffset) / cellWidth());
+		rowsOnScreen = Window::Height() / cellHeight() + 1;
+		bookRows.clear();
+		for (size_t i = 0; i < books.size(); i++) {
+			Book& b = books[i];
+			uint32 n = b.counting.is_done() ? *b.numPages : 0;
+			b.numRows = std::max<uint32>(1, (n + columns - 1) / columns);
+			b.firstRow = static_cast<uint32>(bookRows.add(b.numRows));
+		}
+		totalRows = static_cast<uint32>(bookRows.length());
+	}
+
+	// 行 row にある書籍の番号。なければ -1
+	int bookAtRow(uint32 row) const {
+		return bookRows.find(row);
+	}
+
+	// 画面に出ている行のセル。番号は 行 * columns + 列
+	layout::Grid cells() const {
+		const uint32 top = static_cast<uint32>(scrollRow);
+		layout::Grid g;
+		g.set(Vec2(drawingXOffset, -(scrollRow - top) * cellHeight()), Vec2(cellWidth(), cellHeight()),
+			columns, rowsOnScreen + 1, static_cast<int32>(top * columns), static_cast<int32>(totalRows * columns));
+		return g;
+	}
+
+	// セル index にあるサムネイルの書籍とページ。なければ false
+	bool pageAt(int32 index, int& ibook, uint32& page) const {
+		if (index < 0) return false;
+		const uint32 row = index / columns;
+		ibook = bookAtRow(row);
+		if (ibook < 0) return false;
+		const Book& b = books[ibook];
+		page = (row - b.firstRow) * columns + index % columns;
+		return page < numPagesOf(b);
+	}
+
+	uint32 numPagesOf(const Book& b) const {
+		return b.counting.is_done() ? *b.numPages : 0;
+	}
+
+	void requestRow(uint32 row) {
+		int ibook = bookAtRow(row);
+		if (ibook < 0) return;
+		const Book& b = books[ibook];
+		for (int32 x = 0; x < columns; x++) {
+			uint32 page = (row - b.firstRow) * columns + x;
+			if (page >= numPagesOf(b)) break;
+			thumbnail::get(b.dir, page);
+		}
+	}
+
+	void update() override
+	{
+		layout();
+
+		scrollRow += input.rightThumbY / 2;
+		scrollRow -= pow(input.leftTrigger, 2) * 4;
+		scrollRow += pow(input.rightTrigger, 2) * 4;
+		if (input.clicked(Button::A) || input.clicked(Button::KeyDown)) scrollRow += rowsOnScreen - 1;
+		if (input.clicked(Button::B) || input.clicked(Button::KeyUp)) scrollRow -= rowsOnScreen - 1;
+		scrollRow = Clamp(scrollRow, 0.0, std::max(0.0, static_cast<double>(totalRows) - 1));
+
+		// 画面内を先に頼み、空きがあれば次の1画面分を先読みする
+		uint32 top = static_cast<uint32>(scrollRow);
+		for (uint32 row = top; row < top + rowsOnScreen * 2; row++) {
+			requestRow(row);
+		}
+
+		// Xボタンorクリックでそのページを開く
+		if (input.clicked(Button::X) || input.clicked(Button::MouseL)) {
+			if (input.clicked(Button::MouseL)) {
+				pos = input.mouse;
+			}
+			int ibook;
+			uint32 page;
+			if (pageAt(cells().at(pos), ibook, page)) {
+				loadNewDocument(books[ibook].dir, page);
+			}
+			Cursor::SetPos(0, 0);
+			pos = { 0, 0 };
+		}
+	}
+
+	void draw() const override
+	{
+		infoPaneDraw(font10(L"DisplayLibrary"), infoPaneSlot::Mode);
+		infoPaneDraw(font10(L"thumbnails: ", thumbnail::numCached()), infoPaneSlot::IsAutoPlay);
+
+		const int32 cw = cellWidth(), ch = cellHeight();
+		uint32 top = static_cast<uint32>(scrollRow);
+		double offset = (scrollRow - top) * ch;
+		for (uint32 row = top; row < top + rowsOnScreen + 1; row++) {
+			int ibook = bookAtRow(row);
+			if (ibook < 0) break;
+			const Book& b = books[ibook];
+			double y = (row - top) * ch - offset;
+			for (int32 x = 0; x < columns; x++) {
+				uint32 page = (row - b.firstRow) * columns + x;
+				if (page >= numPagesOf(b)) break;
+				const Texture& t = thumbnail::get(b.dir, page);
+				double left = drawingXOffset + x * cw;
+				if (!t) {
+					Rect(static_cast<int32>(left), static_cast<int32>(y), cw - 2, ch - 2).draw(Color(60));
+					continue;
+				}
+				double w = t.width, h = t.height;
+				double s = std::min((cw - 2) / w, (ch - 2) / h);
+				t.resize(w * s, h * s).draw(left + (cw - 2 - w * s) / 2, y);
+			}
+			// 書籍の先頭行には区切り線と書名を出す
+			if (row == b.firstRow) {
+				Line(drawingXOffset, y, Window::Width(), y).draw(Palette::Orange);
+				font10(bookName(b.dir)).draw(drawingXOffset + 2, y, Palette::Orange);
+			}
+		}
+		// ポインタの下のサムネイル
+		const layout::Grid grid = cells();
+		const int32 hovered = grid.at(pos);
+		int hoveredBook;
+		uint32 hoveredPage;
+		if (pageAt(hovered, hoveredBook, hoveredPage)) {
+			const RectF r = grid.rect(hovered);
+			RectF(r.x, r.y, r.w - 2, r.h - 2).drawFrame(0, 2, Color(255, 255, 0, 127));
+			font10(bookName(books[hoveredBook].dir), L" p.", hoveredPage + 1).draw(pos.x + 12, pos.y);
+		}
+	}
+};
+
+void Main()
+{
+	// ウィンドウを出すまでにすることは最小限にして、書棚は最初のフレームから背景で埋める
+	startup::begin();
+	INIReader config(configFile);
+	updateConfig(config);
+
+	const Array<String> args = ingest::commandLineArgs();
+	if (args.size() >= 3 && args[1] == L"--ingest") {
+		runIngest(args[2], args.size() >= 4 ? args[3] : libraryDirectory, config);
+		return;
+	}
+	replayRecordPath = config.getOr<String>(L"Debug.Record", L"");
+	replaySource = config.getOr<String>(L"Debug.Replay", L"");
+	replayDocument = config.getOr<String>(L"Debug.ReplayDocument", L"");
+	if (replayDocument.isEmpty) replayDocument = currentDocument;
+	replayReportPath = config.getOr<String>(L"Debug.ReplayReport", L"replay_report.txt");
+	const uint64 sharedCacheBytes = config.getOr<uint64>(L"SharedCache.SizeMB", 0) << 20;
+	if (sharedCacheBytes > 0 && replaySource.isEmpty) { // 再生の計測は他のウィンドウの影響を受けないように
+		sharedcache::open(sharedCacheBytes);
+	}
+	startup::phase(L"config");
+
+	Window::SetTitle(L"Speedreader");
+	Window::Resize(1300, 700);
+	Window::ToUpperLeft();
+	Window::SetStyle(WindowStyle::Sizeable);
+	font10 = Font(10);
+
+	Cursor::SetPos(0, 0);
+
+	// ESCでWindowを閉じない
+	System::SetExitEvent(WindowEvent::CloseButton);
+	startup::phase(L"window");
+
+	controller.setLeftTriggerDeadZone();
+	controller.setRightTriggerDeadZone();
+	controller.setLeftThumbDeadZone();
+	controller.setRightThumbDeadZone();
+	startup::phase(L"controller");
+
+	// 書棚の init() は走査を始めるだけですぐ戻る
+	sceneManager.add<DisplayBooks>(sceneName::DisplayBooks);
+	sceneManager.add<DisplaySinglePage>(sceneName::DisplaySinglePage);
+	sceneManager.add<DisplayPages>(sceneName::DisplayPages);
+	sceneManager.add<LoadPages>(sceneName::LoadPages);
+	sceneManager.add<DisplayLibrary>(sceneName::DisplayLibrary);
+	sceneManager.changeScene(sceneName::DisplayBooks, 0, false);
+	startup::phase(L"scenes");
+
+	Stopwatch stopwatch(true);
+
+	// Debug.Replay が指定されていればライブ入力の代わりに記録を流し込み、結果をレポートに書いて終了する
+	Array<String> scenarios;
+	if (replaySource == L"All") {
+		scenarios = replay::standardScenarios;
+	}
+	else if (!replaySource.isEmpty) {
+		scenarios.push_back(replaySource);
+	}
+	const bool replaying = !scenarios.empty();
+	Array<replay::InputFrame> frames;
+	size_t scenarioIndex = 0;
+	size_t frameIndex = 0;
+	replay::Report report;
+	auto startScenario = [&]() {
+		const String& source = scenarios[scenarioIndex];
+		frames = FileSystem::Exists(source) ? replay::loadRecording(source) : replay::makeScenario(source);
+		frameIndex = 0;
+		report = replay::Report();
+		loadNewDocument(replayDocument, 0);
+		loader::resetStats();
+	};
+
+	replay::Recorder recorder;
+	std::unique_ptr<replay::Pacer> pacer;
+	double workMs = 0;
+	if (replaying) {
+		persistReadingState = false;
+		FileSystem::Remove(replayReportPath);
+		// 垂直同期は待たずに、フレームの終わりで記録した dt まで待つ。待つ前までを作業時間として測る
+		Graphics::SetVSyncEnabled(false);
+		pacer = std::make_unique<replay::Pacer>();
+		startScenario();
+	}
+	else if (!replayRecordPath.isEmpty) {
+		recorder.open(replayRecordPath);
+	}
+
+	double msecFromLastFPSUpdate = 0;
+	int FPS;
+	while (System::Update())
+	{
+		invFPS = stopwatch.us() / 1000.0;
+		msecFromLastFPSUpdate += invFPS;
+		if (msecFromLastFPSUpdate > 250) {
+			FPS = static_cast<int>(1000.0 / invFPS);
+			msecFromLastFPSUpdate = 0;
+		}
+
+		infoPaneDraw(font10(L"FPS: ", FPS), infoPaneSlot::FPS);
+		stopwatch.restart();
+
+		if (replaying) {
+			if (frameIndex > 0) {
+				report.endFrame(invFPS, workMs, numBlankPages);
+			}
+			if (frameIndex >= frames.size()) {
+				report.write(replayReportPath, scenarios[scenarioIndex], replayDocument,
+					loader::numHits, loader::numMisses, loader::numEvicted, loader::numLoaded(), loader::numPages, loader::numDuplicates,
+					loader::sequenceReader ? loader::sequenceReader.describe() : String(L"none"));
+				if (++scenarioIndex >= scenarios.size()) {
+					break;
+				}
+				startScenario();
+			}
+			input = frames[frameIndex++];
+		}
+		else {
+			input = replay::capture(controller, invFPS);
+			recorder.write(input);
+		}
+		numBlankPages = 0;
+		thumbnail::update();
+
+		if (config.hasChanged()) updateConfig(config);
+
+		if (!replaying && Dragdrop::HasItems())
+		{
+			const Array<FilePath> items = Dragdrop::GetFilePaths();
+			loadNewDocument(items[0]);
+		}
+
+
+		pos += Vec2(
+			input.leftThumbX * joystickPointerSpeed * input.dt,
+			-input.leftThumbY * joystickPointerSpeed * input.dt);
+		//pos += Mouse::Delta();  // マウスも併用する場合はジョイスティックでの移動差分をマウスの入力と勘違いするので用修正
+		if (pos.x < 0) pos.x = 0;
+		if (pos.y < 0) pos.y = 0;
+		if (pos.x > Window::Width()) pos.x = Window::Width();
+		if (pos.y > Window::Height()) pos.y = Window::Height();
+
+		if (documentOpen) {
+			// 画面に出ている範囲は前のフレームで並べた索引から取る
+			loader::setView(pageGrid.size() ? pageGrid.begin() : static_cast<int>(viewingPage), std::max(1, pageGrid.size()));
+			governor::update();
+			infoPaneDraw(font10(governor::describe()), infoPaneSlot::Memory);
+			infoPaneDraw(font10(L"duplicates: ", loader::numDuplicates, L"/", loader::numPages), infoPaneSlot::Dedup);
+			if (sharedcache::isOpen()) {
+				infoPaneDraw(font10(sharedcache::describe()), infoPaneSlot::SharedCache);
+			}
+		}
+
+		sceneManager.update();
+
+		if (input.clicked(Button::LB) || input.clicked(Button::KeyZ)) {
+			numPageVertical--;
+			if (numPageVertical < minNumPageVertical) numPageVertical = minNumPageVertical;
+			if (numPageVertical == 0) {
+				sceneManager.changeScene(sceneName::DisplaySinglePage, 0, false);
+			}
+		}
+		if (input.clicked(Button::RB) || input.clicked(Button::KeyC)) {
+			numPageVertical++;
+			if (numPageVertical == 1) {
+				sceneManager.changeScene(sceneName::DisplayPages, 0, false);
+			}
+		}
+
+		/*
+		int ipage = static_cast<int>(viewingPage) % numPages;
+		Texture t = loader::getPage(ipage);
+		double h = static_cast<double>(t.height);
+		double w = static_cast<double>(t.width);
+		//const int screenHeight = 640;
+		int screenHeight = Window::Height();
+		double pageHeight = screenHeight, pageWidth = w / h * pageHeight;
+
+		int horizontalMultiplier = 2; // 見開きにするなら2、しないなら1
+		if (h < w) horizontalMultiplier = 1;
+
+		*/
+
+		sceneManager.draw();
+		startup::milestone(L"first interactive frame");
+
+
+		// 書籍一覧
+		if (input.clicked(Button::Y) || input.clicked(Button::KeyX)) {
+			closeDocument();
+			sceneManager.changeScene(sceneName::DisplayBooks, 0, false);
+		}
+		// 全書籍のモザイク
+		if (input.clicked(Button::Back) || input.clicked(Button::KeyL)) {
+			closeDocument();
+			sceneManager.changeScene(sceneName::DisplayLibrary, 0, false);
+		}
+
+		if (input.clicked(Button::KeyR)) {
+			reverseDisplayOrder();
+		}
+
+		// カーソル表示
+		Circle(pos, 10).draw({ 255, 255, 0, 127 });
+
+		if (replaying) {
+			workMs = stopwatch.us() / 1000.0;
+			pacer->wait(stopwatch, input.dt);
+		}
+	}
+
+	closeDocument();
+	loader::waitPersist();
+	bands::waitWrites();
+	sharedcache::close();
+}
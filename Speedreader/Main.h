@@ -1,3 +1,3 @@
-#pragma once
-
-void Main();
+#pragma once
+
+void Main();
@@ -0,0 +1,282 @@
+#pragma once
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#include <Siv3D.hpp>
+#include <algorithm>
+#include <thread>
+
+#pragma comment(lib, "winmm.lib")
+
+// 入力の記録と再生
+// 「本XでRTを10秒押しっぱなしにすると白紙ページが出る」のような性能バグを再現するため、
+// コントローラとキーボードの入力を1フレームずつ記録し、あとで同じ入力をシーンに流し込む。
+namespace replay
+{
+	enum class Button : uint32 {
+		A = 1 << 0,
+		B = 1 << 1,
+		X = 1 << 2,
+		Y = 1 << 3,
+		LB = 1 << 4,
+		RB = 1 << 5,
+		KeyRight = 1 << 6,
+		KeyLeft = 1 << 7,
+		KeyDown = 1 << 8,
+		KeyUp = 1 << 9,
+		ShiftDown = 1 << 10,
+		ShiftUp = 1 << 11,
+		KeyZ = 1 << 12,
+		KeyC = 1 << 13,
+		KeyX = 1 << 14,
+		KeyR = 1 << 15,
+		MouseL = 1 << 16,
+		Back = 1 << 17,
+		KeyL = 1 << 18,
+	};
+
+	// 1フレーム分の入力。シーンはライブ入力か再生かを区別せずこれだけを見る
+	struct InputFrame {
+		double dt = 0; // 前フレームからの経過時間(ms)
+		double leftTrigger = 0;
+		double rightTrigger = 0;
+		double leftThumbX = 0;
+		double leftThumbY = 0;
+		double rightThumbX = 0;
+		double rightThumbY = 0;
+		uint32 buttons = 0; // clicked になったボタンのビット和
+		Point mouse = { 0, 0 };
+
+		bool clicked(Button b) const {
+			return (buttons & static_cast<uint32>(b)) != 0;
+		}
+		void set(Button b, bool on) {
+			if (on) buttons |= static_cast<uint32>(b);
+		}
+	};
+
+	InputFrame capture(const XInput& controller, double dt) {
+		InputFrame f;
+		f.dt = dt;
+		f.leftTrigger = controller.leftTrigger;
+		f.rightTrigger = controller.rightTrigger;
+		f.leftThumbX = controller.leftThumbX;
+		f.leftThumbY = controller.leftThumbY;
+		f.rightThumbX = controller.rightThumbX;
+		f.rightThumbY = controller.rightThumbY;
+		f.set(Button::A, controller.buttonA.clicked);
+		f.set(Button::B, controller.buttonB.clicked);
+		f.set(Button::X, controller.buttonX.clicked);
+		f.set(Button::Y, controller.buttonY.clicked);
+		f.set(Button::LB, controller.buttonLB.clicked);
+		f.set(Button::RB, controller.buttonRB.clicked);
+		f.set(Button::KeyRight, Input::KeyRight.clicked);
+		f.set(Button::KeyLeft, Input::KeyLeft.clicked);
+		f.set(Button::KeyDown, Input::KeyDown.clicked);
+		f.set(Button::KeyUp, Input::KeyUp.clicked);
+		f.set(Button::ShiftDown, (Input::KeyDown + Input::KeyShift).clicked);
+		f.set(Button::ShiftUp, (Input::KeyUp + Input::KeyShift).clicked);
+		f.set(Button::KeyZ, Input::KeyZ.clicked);
+		f.set(Button::KeyC, Input::KeyC.clicked);
+		f.set(Button::KeyX, Input::KeyX.clicked);
+		f.set(Button::KeyR, Input::KeyR.clicked);
+		f.set(Button::MouseL, Input::MouseL.clicked);
+		f.set(Button::Back, controller.buttonBack.clicked);
+		f.set(Button::KeyL, Input::KeyL.clicked);
+		f.mouse = Mouse::Pos();
+		return f;
+	}
+
+	// CSV 1行 = 1フレーム
+	class Recorder {
+	public:
+		bool open(const String& path) {
+			writer = TextWriter(path);
+			if (!writer) return false;
+			writer.writeln(L"dt,leftTrigger,rightTrigger,leftThumbX,leftThumbY,rightThumbX,rightThumbY,buttons,mouseX,mouseY");
+			return true;
+		}
+		void write(const InputFrame& f) {
+			if (!writer) return;
+			writer.writeln(Format(f.dt, L',', f.leftTrigger, L',', f.rightTrigger, L',',
+				f.leftThumbX, L',', f.leftThumbY, L',', f.rightThumbX, L',', f.rightThumbY, L',',
+				f.buttons, L',', f.mouse.x, L',', f.mouse.y));
+		}
+		bool isOpen() const {
+			return static_cast<bool>(writer);
+		}
+	private:
+		TextWriter writer;
+	};
+
+	Array<InputFrame> loadRecording(const String& path) {
+		Array<InputFrame> frames;
+		CSVReader csv(path);
+		if (!csv) return frames;
+		// rightThumbX の列がない古い録画も読めるよう、ヘッダで列の位置を決める
+		const size_t x = csv.get<String>(0, 5) == L"rightThumbX" ? 1 : 0;
+		for (size_t row = 1; row < csv.rows; row++) { // 0行目はヘッダ
+			InputFrame f;
+			f.dt = csv.get<double>(row, 0);
+			f.leftTrigger = csv.get<double>(row, 1);
+			f.rightTrigger = csv.get<double>(row, 2);
+			f.leftThumbX = csv.get<double>(row, 3);
+			f.leftThumbY = csv.get<double>(row, 4);
+			f.rightThumbX = x ? csv.get<double>(row, 5) : 0.0;
+			f.rightThumbY = csv.get<double>(row, 5 + x);
+			f.buttons = csv.get<uint32>(row, 6 + x);
+			f.mouse = { csv.get<int32>(row, 7 + x), csv.get<int32>(row, 8 + x) };
+			frames.push_back(f);
+		}
+		return frames;
+	}
+
+	// 録画ファイルがなくても回せる標準のめくりシナリオ。60fps固定
+	const double scenarioFrameMs = 1000.0 / 60;
+
+	Array<InputFrame> makeScenario(const String& name) {
+		Array<InputFrame> frames;
+		auto idle = [&](int n) {
+			for (int i = 0; i < n; i++) {
+				InputFrame f;
+				f.dt = scenarioFrameMs;
+				frames.push_back(f);
+			}
+		};
+		auto click = [&](Button b) {
+			InputFrame f;
+			f.dt = scenarioFrameMs;
+			f.set(b, true);
+			frames.push_back(f);
+		};
+
+		// 文書を開いた直後は LoadPages なので、Aボタンで DisplayPages に入ってから始める
+		click(Button::A);
+
+		if (name == L"HoldRT") {
+			// RTを10秒押しっぱなし
+			for (int i = 0; i < 600; i++) {
+				InputFrame f;
+				f.dt = scenarioFrameMs;
+				f.rightTrigger = 1.0;
+				frames.push_back(f);
+			}
+		}
+		else if (name == L"Autoplay") {
+			// →を4回押して倍速にしていき、10秒流す
+			for (int i = 0; i < 4; i++) {
+				click(Button::KeyRight);
+				idle(59);
+			}
+			idle(600);
+		}
+		else if (name == L"PageDown") {
+			// Aボタンで見開き送りを1秒に6回
+			for (int i = 0; i < 60; i++) {
+				click(Button::A);
+				idle(9);
+			}
+		}
+		else if (name == L"ZoomOutFlip") {
+			// 4段階縮小してからRTでめくる
+			for (int i = 0; i < 4; i++) {
+				click(Button::RB);
+				idle(29);
+			}
+			for (int i = 0; i < 300; i++) {
+				InputFrame f;
+				f.dt = scenarioFrameMs;
+				f.rightTrigger = 1.0;
+				frames.push_back(f);
+			}
+		}
+		return frames;
+	}
+
+	const Array<String> standardScenarios = { L"HoldRT", L"Autoplay", L"PageDown", L"ZoomOutFlip" };
+
+	// 再生のフレームを記録した間隔(dt)まで引き延ばす。
+	// 垂直同期を切って回すと1フレームの時間が実際より短くなり、その間に背景の読み込みが追いつかないので、
+	// めくる速さが記録のときと変わってしまう。待つ前までの時間は作業時間として別に測る
+	class Pacer {
+	public:
+		Pacer() {
+			timeBeginPeriod(1); // Sleep の粒度を1msにする
+		}
+		~Pacer() {
+			timeEndPeriod(1);
+		}
+		// frame はフレームの頭から回している Stopwatch
+		void wait(const Stopwatch& frame, double dtMs) const {
+			while (true) {
+				const double remaining = dtMs - frame.us() / 1000.0;
+				if (remaining <= 0) break;
+				if (remaining > 2) {
+					std::this_thread::sleep_for(std::chrono::microseconds(static_cast<int64>((remaining - 1.5) * 1000)));
+				}
+				else {
+					std::this_thread::yield();
+				}
+			}
+		}
+	};
+
+	// 再生中のフレームごとの計測結果。
+	// frame はフレームの間隔(待ちと画面の更新を含む)、work は待つ前までの描画と読み込みにかかった時間
+	class Report {
+	public:
+		void endFrame(double frameMs, double workMs, int blankPages) {
+			frameTimes.push_back(frameMs);
+			workTimes.push_back(workMs);
+			if (blankPages > 0) {
+				numBlankFrames++;
+				numBlankPages += blankPages;
+			}
+		}
+
+		static double percentile(const Array<double>& times, double p) {
+			if (times.empty()) return 0;
+			Array<double> sorted = times;
+			std::sort(sorted.begin(), sorted.end());
+			size_t i = static_cast<size_t>(p / 100 * (sorted.size() - 1));
+			return sorted[i];
+		}
+
+		double percentile(double p) const {
+			return percentile(frameTimes, p);
+		}
+
+		void write(const String& path, const String& scenario, const String& document,
+			uint32 cacheHits, uint32 cacheMisses, uint32 evictions, uint32 pagesLoaded, uint32 numPages, uint32 duplicates,
+			const String& sequence) const {
+			TextWriter writer(path, OpenMode::Append);
+			writer.writeln(L"[", scenario, L"]");
+			writer.writeln(L"document = ", document);
+			writer.writeln(L"frames = ", frameTimes.size());
+			writer.writeln(L"blankFrames = ", numBlankFrames);
+			writer.writeln(L"blankPages = ", numBlankPages);
+			writer.writeln(L"frameMsP50 = ", percentile(frameTimes, 50));
+			writer.writeln(L"frameMsP90 = ", percentile(frameTimes, 90));
+			writer.writeln(L"frameMsP99 = ", percentile(frameTimes, 99));
+			writer.writeln(L"frameMsMax = ", percentile(frameTimes, 100));
+			writer.writeln(L"workMsP50 = ", percentile(workTimes, 50));
+			writer.writeln(L"workMsP90 = ", percentile(workTimes, 90));
+			writer.writeln(L"workMsP99 = ", percentile(workTimes, 99));
+			writer.writeln(L"workMsMax = ", percentile(workTimes, 100));
+			writer.writeln(L"cacheHits = ", cacheHits);
+			writer.writeln(L"cacheMisses = ", cacheMisses);
+			writer.writeln(L"evictions = ", evictions);
+			writer.writeln(L"pagesLoaded = ", pagesLoaded, L"/", numPages);
+			writer.writeln(L"duplicates = ", duplicates);
+			writer.writeln(L"sequence = ", sequence);
+			writer.writeln(L"");
+		}
+
+	private:
+		Array<double> frameTimes;
+		Array<double> workTimes;
+		uint32 numBlankFrames = 0;
+		uint32 numBlankPages = 0;
+	};
+}
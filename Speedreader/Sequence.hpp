@@ -0,0 +1,358 @@
+#pragma once
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#include <compressapi.h>
+#include <atomic>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <Siv3D.hpp>
+#include "AtomicFile.hpp"
+
+#pragma comment(lib, "cabinet.lib")
+
+// 隣のページとのXORをランレングスとXPRESS+ハフマン符号で詰めて並べた書籍ごとのシーケンスファイル(sequence.bin)
+// 形式は Header | 各ページの差分 | Index[numPages] | Indexの位置(uint64)。同じ差分で前にも後ろにもめくれる
+namespace sequence
+{
+	const uint32 magic = 0x51535053; // "SPSQ"
+	const uint32 version = 2;
+	const uint32 runFlag = 0x80000000u; // 立っているトークンは続く1語の繰り返し、立っていなければ続く token 語をそのまま使う
+	int32 maxSteps = 16;
+
+	struct Header {
+		uint32 magic;
+		uint32 version;
+		uint32 numPages;
+		uint32 reserved;
+	};
+
+	struct IndexEntry {
+		uint64 offset;
+		uint32 bytes;        // 圧縮した差分のバイト数
+		uint32 words;        // 前のページとの差分の語数。0なら差分なし(大きさが違うか先頭ページ)
+		int32 width;         // 差分を取った大きさ
+		int32 height;
+		int32 sourceWidth;   // 元のPNGの大きさ。取り込み後に差し替えられたページを見分ける
+		int32 sourceHeight;
+	};
+
+	FilePath sequencePath(const FilePath& doc) {
+		return Format(L"{}sequence.bin"_fmt, doc);
+	}
+
+	// 元の大きさ source のページの差分を取る大きさ。height が0なら原寸
+	Size frameSize(const Size& source, int32 height) {
+		if (height <= 0 || source.y <= height) return source;
+		return Size(std::max(1, source.x * height / source.y), height);
+	}
+
+	// XPRESS+ハフマン符号で圧縮する。失敗したら空
+	Array<uint8> compress(const void* data, size_t size) {
+		Array<uint8> packed;
+		COMPRESSOR_HANDLE compressor = nullptr;
+		if (!CreateCompressor(COMPRESS_ALGORITHM_XPRESS_HUFF, nullptr, &compressor)) return packed;
+		SIZE_T needed = 0;
+		Compress(compressor, data, size, nullptr, 0, &needed);
+		packed.resize(needed);
+		SIZE_T written = 0;
+		if (needed > 0 && Compress(compressor, data, size, packed.data(), packed.size(), &written)) {
+			packed.resize(written);
+		}
+		else {
+			packed.clear();
+		}
+		CloseCompressor(compressor);
+		return packed;
+	}
+
+	// cur ^ prev をトークン列にする
+	Array<uint32> encodeDelta(const Image& prev, const Image& cur) {
+		const uint32* a = reinterpret_cast<const uint32*>(prev.data());
+		const uint32* b = reinterpret_cast<const uint32*>(cur.data());
+		const size_t n = static_cast<size_t>(cur.width) * cur.height;
+		Array<uint32> out;
+		size_t i = 0;
+		while (i < n) {
+			const uint32 x = a[i] ^ b[i];
+			size_t run = 1;
+			while (i + run < n && run < 0x7fffffff && (a[i + run] ^ b[i + run]) == x) run++;
+			if (run >= 3) {
+				out.push_back(runFlag | static_cast<uint32>(run));
+				out.push_back(x);
+				i += run;
+				continue;
+			}
+			// 同じ値が3語以上続くところまでをそのまま入れる
+			const size_t head = out.size();
+			out.push_back(0);
+			size_t literal = 0;
+			while (i < n && literal < 0x7fffffff) {
+				const uint32 y = a[i] ^ b[i];
+				if (i + 2 < n && (a[i + 1] ^ b[i + 1]) == y && (a[i + 2] ^ b[i + 2]) == y) break;
+				out.push_back(y);
+				literal++;
+				i++;
+			}
+			out[head] = static_cast<uint32>(literal);
+		}
+		return out;
+	}
+
+	// 画素に差分をXORする。前にも後ろにも使える
+	void applyDelta(Image& image, const uint32* tokens, size_t numTokens) {
+		uint32* p = reinterpret_cast<uint32*>(image.data());
+		const uint32* end = p + static_cast<size_t>(image.width) * image.height;
+		size_t k = 0;
+		while (k < numTokens && p < end) {
+			const uint32 token = tokens[k++];
+			if (token & runFlag) {
+				const uint32 x = tokens[k++];
+				const size_t run = std::min<size_t>(token & ~runFlag, end - p);
+				if (x != 0) {
+					for (size_t j = 0; j < run; j++) p[j] ^= x;
+				}
+				p += run;
+			}
+			else {
+				const size_t literal = std::min<size_t>(token, end - p);
+				for (size_t j = 0; j < literal; j++) p[j] ^= tokens[k + j];
+				p += literal;
+				k += token;
+			}
+		}
+	}
+
+	// 取り込み時に呼ぶ。ページを1枚ずつ読んで height に縮め、前のページとの差分を圧縮して順に書き出す。
+	// 持っている画像は前のページと今のページの2枚だけなので、取り込みのパイプラインのメモリの上限を崩さない
+	bool write(const FilePath& doc, uint32 numPages, int32 height, std::function<Image(int)> load) {
+		return atomicfile::write(sequencePath(doc), [&](const FilePath& tmp) {
+			Array<IndexEntry> index(numPages);
+			BinaryWriter writer(tmp);
+			if (!writer) return false;
+			Header header = { magic, version, numPages, 0 };
+			writer.write(header);
+			uint64 offset = sizeof(Header);
+			Image prev;
+			for (uint32 i = 0; i < numPages; i++) {
+				Image image = load(i);
+				IndexEntry& e = index[i];
+				e.sourceWidth = image.width;
+				e.sourceHeight = image.height;
+				const Size size = frameSize(Size(image.width, image.height), height);
+				if (image && image.size != size) {
+					image.scale(size.x, size.y);
+				}
+				e.offset = offset;
+				e.bytes = 0;
+				e.words = 0;
+				e.width = image.width;
+				e.height = image.height;
+				if (prev && image && prev.size == image.size) {
+					const Array<uint32> tokens = encodeDelta(prev, image);
+					const Array<uint8> packed = compress(tokens.data(), tokens.size() * sizeof(uint32));
+					if (!packed.empty()) {
+						writer.write(packed.data(), packed.size());
+						e.bytes = static_cast<uint32>(packed.size());
+						e.words = static_cast<uint32>(tokens.size());
+						offset += packed.size();
+					}
+				}
+				prev = std::move(image);
+			}
+			writer.write(index.data(), index.size() * sizeof(IndexEntry));
+			writer.write(offset);
+			return true;
+		});
+	}
+
+	// ページを順にめくる再生用のデコーダ。
+	// loader の背景タスクから同時に呼ばれるので、直前に出したページを持つカーソルを何本か持ち、
+	// 頼まれたページに maxSteps 以内でたどり着ける空いたカーソルがあればそれを借りて前へも後ろへも差分をたどる。
+	// ロックの中ではカーソルの貸し借りだけをし、ファイルの読み込みやキーフレームのデコードはロックの外で行うので、
+	// 前へ進むカーソルと後ろへ戻るカーソルが別々のワーカーで並列に進む。空いたカーソルがなければPNGをそのままデコードする
+	class Reader {
+	public:
+		bool open(const FilePath& doc, uint32 numPages, size_t numCursors, std::function<Image(int)> decodeKey) {
+			std::lock_guard<std::mutex> lock(mutex);
+			close_();
+			path = sequencePath(doc);
+			if (!FileSystem::Exists(path)) return false;
+			BinaryReader file(path);
+			Header header;
+			if (!file || !file.read(header) || header.magic != magic || header.version != version || header.numPages != numPages) {
+				return false;
+			}
+			uint64 indexOffset = 0;
+			file.setPos(file.size() - sizeof(uint64));
+			file.read(indexOffset);
+			Array<IndexEntry> entries(numPages);
+			file.setPos(indexOffset);
+			if (file.read(entries.data(), entries.size() * sizeof(IndexEntry)) != static_cast<int64>(entries.size() * sizeof(IndexEntry))) {
+				return false;
+			}
+			for (size_t i = 0; i < std::max<size_t>(1, numCursors); i++) {
+				auto c = std::make_unique<Cursor>();
+				c->file = BinaryReader(path);
+				if (!CreateDecompressor(COMPRESS_ALGORITHM_XPRESS_HUFF, nullptr, &c->decompressor)) {
+					return false;
+				}
+				cursors.push_back(std::move(c));
+			}
+			index = std::move(entries);
+			key = decodeKey;
+			return true;
+		}
+
+		// read() を呼んでいるタスクがないときに呼ぶ
+		void close() {
+			std::lock_guard<std::mutex> lock(mutex);
+			close_();
+		}
+
+		explicit operator bool() const {
+			return !index.isEmpty;
+		}
+
+		// page の差分を取った大きさ。read() が返す大きさ
+		Size sizeOf(int page) const {
+			if (index.isEmpty || page < 0 || page >= static_cast<int>(index.size())) return Size(0, 0);
+			return Size(index[page].width, index[page].height);
+		}
+
+		// page の画素(差分を取った大きさ)。シーケンスがなければ空のImage
+		Image read(int page) {
+			if (index.isEmpty || page < 0 || page >= static_cast<int>(index.size())) return Image();
+			Cursor* c = borrow(page);
+			bool matches;
+			if (!c) {
+				return keyFrame(page, matches);
+			}
+			bool stepped = reachable(c->position, page);
+			while (stepped && c->position < page) stepped = step(*c, ++c->position);
+			while (stepped && c->position > page) stepped = step(*c, c->position--);
+			if (!stepped) {
+				c->current = keyFrame(page, matches);
+				// 取り込み後にページが差し替えられていたら差分は使えない
+				c->position = matches ? page : -1;
+			}
+			Image image = c->current;
+			std::lock_guard<std::mutex> lock(mutex);
+			c->busy = false;
+			return image;
+		}
+
+		// 差分とキーフレームそれぞれの回数と1枚あたりの時間。再生のレポートに書く
+		String describe() const {
+			return Format(L"steps ", numSteps.load(), L" (", numSteps ? stepUs / numSteps / 1000.0 : 0.0, L"ms/page) / keys ",
+				numKeys.load(), L" (", numKeys ? keyUs / numKeys / 1000.0 : 0.0, L"ms/page)");
+		}
+
+		void resetStats() {
+			numSteps = 0;
+			numKeys = 0;
+			stepUs = 0;
+			keyUs = 0;
+		}
+
+		std::atomic<uint32> numSteps{ 0 };   // 差分でめくった回数
+		std::atomic<uint32> numKeys{ 0 };    // PNGをデコードした回数
+		std::atomic<uint64> stepUs{ 0 };
+		std::atomic<uint64> keyUs{ 0 };
+
+	private:
+		struct Cursor {
+			BinaryReader file;
+			DECOMPRESSOR_HANDLE decompressor = nullptr;
+			Image current;
+			int32 position = -1;
+			bool busy = false;
+			uint64 lastUsed = 0;
+			Array<uint8> packed;
+			Array<uint32> tokens;
+
+			~Cursor() {
+				if (decompressor) CloseDecompressor(decompressor);
+			}
+		};
+
+		FilePath path;
+		Array<IndexEntry> index;
+		std::function<Image(int)> key;
+		Array<std::unique_ptr<Cursor>> cursors;
+		uint64 clock = 0;
+		std::mutex mutex;
+
+		void close_() {
+			cursors.clear();
+			index.clear();
+		}
+
+		// page に一番近くてたどり着ける空いたカーソル。なければ一番長く使っていない空いたカーソル。どれも使用中なら nullptr
+		Cursor* borrow(int32 page) {
+			std::lock_guard<std::mutex> lock(mutex);
+			Cursor* best = nullptr;
+			Cursor* oldest = nullptr;
+			for (auto& c : cursors) {
+				if (c->busy) continue;
+				if (reachable(c->position, page) && (!best || std::abs(c->position - page) < std::abs(best->position - page))) {
+					best = c.get();
+				}
+				if (!oldest || c->lastUsed < oldest->lastUsed) {
+					oldest = c.get();
+				}
+			}
+			Cursor* c = best ? best : oldest;
+			if (c) {
+				c->busy = true;
+				c->lastUsed = ++clock;
+			}
+			return c;
+		}
+
+		// page のPNGをデコードして差分と同じ大きさにする。matches は取り込んだときと同じ大きさのPNGだったか
+		Image keyFrame(int32 page, bool& matches) {
+			Stopwatch stopwatch(true);
+			const IndexEntry& e = index[page];
+			Image image = key(page);
+			matches = image && image.width == e.sourceWidth && image.height == e.sourceHeight;
+			if (matches && (image.width != e.width || image.height != e.height)) {
+				image.scale(e.width, e.height);
+			}
+			keyUs += stopwatch.us();
+			numKeys++;
+			return image;
+		}
+
+		// page とその前のページの差分を c.current にXORする。読めなければ false
+		bool step(Cursor& c, int32 page) {
+			Stopwatch stopwatch(true);
+			const IndexEntry& e = index[page];
+			c.packed.resize(e.bytes);
+			c.tokens.resize(e.words);
+			c.file.setPos(e.offset);
+			SIZE_T written = 0;
+			if (c.file.read(c.packed.data(), e.bytes) != static_cast<int64>(e.bytes)
+				|| !Decompress(c.decompressor, c.packed.data(), e.bytes, c.tokens.data(), e.words * sizeof(uint32), &written)
+				|| written != e.words * sizeof(uint32)) {
+				c.position = -1;
+				return false;
+			}
+			applyDelta(c.current, c.tokens.data(), c.tokens.size());
+			stepUs += stopwatch.us();
+			numSteps++;
+			return true;
+		}
+
+		bool reachable(int32 from, int32 to) const {
+			if (from < 0 || std::abs(to - from) > maxSteps) return false;
+			for (int32 i = std::min(from, to) + 1; i <= std::max(from, to); i++) {
+				if (index[i].words == 0) return false;
+			}
+			return true;
+		}
+	};
+}
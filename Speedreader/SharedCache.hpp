@@ -0,0 +1,363 @@
+#pragma once
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#include <atomic>
+#include <cstring>
+#include <cwctype>
+#include <Siv3D.hpp>
+
+// 同じマシンのビューワー同士で共有する、デコード済みページのキャッシュ。(書籍, ページ, 幅と高さ) をキーに名前付きのファイルマッピングに置く
+// 表の形を変えたら名前と magic を変えて、古いビューワーとは別の領域にする
+namespace sharedcache
+{
+	const wchar_t* mappingName = L"Local\\Speedreader.PageCache.3";
+	const wchar_t* mutexName = L"Local\\Speedreader.PageCache.3.Lock";
+	const uint32 magic = 0x53504333; // "SPC3"
+	const uint64 blockBytes = 1ull << 20;
+	const uint32 numEntries = 1024;
+	const uint32 maxHolders = 4; // 1つのページを同時に読めるプロセス数。埋まっていれば読まずにPNGから読む
+
+	enum class EntryState : uint32 {
+		Empty,
+		Writing,
+		Ready,
+	};
+
+	struct Header {
+		uint32 magic;
+		uint32 numBlocks;
+		uint64 clock;     // lastUsed に入れる通し番号
+		uint64 hits;
+		uint64 misses;
+		uint64 evictions;
+	};
+
+	struct Holder {
+		uint32 process;   // プロセスID
+		uint32 count;     // そのプロセスで読んでいるスレッド数
+	};
+
+	struct Entry {
+		uint64 document;  // 書籍のパスのハッシュ
+		int32 page;
+		int32 width;      // 幅と高さもキー。ウィンドウごとに ring の大きさが違うので
+		int32 height;
+		EntryState state;
+		uint32 writer;    // Writing のとき書いているプロセスID
+		uint32 firstBlock;
+		uint32 numBlocks;
+		uint64 lastUsed;
+		Holder holders[maxHolders]; // 読み中のプロセス。誰かが読んでいるか書いている間は捨てない
+	};
+
+	HANDLE mapping = nullptr;
+	HANDLE mutex = nullptr;
+	uint8* view = nullptr;
+	std::atomic<uint32> numHits{ 0 };   // このプロセスの分
+	std::atomic<uint32> numMisses{ 0 };
+
+	bool isOpen() {
+		return view != nullptr;
+	}
+
+	namespace detail
+	{
+		Header* header() { return reinterpret_cast<Header*>(view); }
+		Entry* entries() { return reinterpret_cast<Entry*>(view + sizeof(Header)); }
+		int32* blockOwner() { return reinterpret_cast<int32*>(view + sizeof(Header) + sizeof(Entry) * numEntries); }
+
+		uint64 dataOffset(uint32 numBlocks) {
+			const uint64 table = sizeof(Header) + sizeof(Entry) * numEntries + sizeof(int32) * numBlocks;
+			return (table + 0xffff) & ~0xffffull;
+		}
+
+		uint8* blockData(uint32 block) {
+			return view + dataOffset(header()->numBlocks) + block * blockBytes;
+		}
+
+		bool isAlive(uint32 process) {
+			if (process == GetCurrentProcessId()) return true;
+			HANDLE h = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, process);
+			if (!h) {
+				// 開けないのは権限がないだけかもしれないので、そのときは生きているとみなす
+				return GetLastError() == ERROR_ACCESS_DENIED;
+			}
+			DWORD code = 0;
+			const bool alive = GetExitCodeProcess(h, &code) && code == STILL_ACTIVE;
+			CloseHandle(h);
+			return alive;
+		}
+
+		bool isReferenced(const Entry& e) {
+			if (e.state == EntryState::Writing) return true;
+			for (const auto& h : e.holders) {
+				if (h.count > 0) return true;
+			}
+			return false;
+		}
+
+		// 落ちたプロセスが残した参照と書きかけを片付ける。ロックの中で呼ぶ
+		void reapDead() {
+			Entry* e = entries();
+			for (uint32 i = 0; i < numEntries; i++) {
+				if (e[i].state == EntryState::Empty) continue;
+				for (auto& h : e[i].holders) {
+					if (h.count > 0 && !isAlive(h.process)) h.count = 0;
+				}
+				if (e[i].state == EntryState::Writing && !isAlive(e[i].writer)) {
+					for (uint32 b = 0; b < e[i].numBlocks; b++) blockOwner()[e[i].firstBlock + b] = -1;
+					e[i].state = EntryState::Empty;
+				}
+			}
+		}
+
+		// このプロセスの参照を1つ増やす。空きがなければ false
+		bool hold(Entry& e) {
+			const uint32 self = GetCurrentProcessId();
+			Holder* free = nullptr;
+			for (auto& h : e.holders) {
+				if (h.count > 0 && h.process == self) {
+					h.count++;
+					return true;
+				}
+				if (h.count == 0 && !free) free = &h;
+			}
+			if (!free) return false;
+			free->process = self;
+			free->count = 1;
+			return true;
+		}
+
+		void unhold(Entry& e) {
+			const uint32 self = GetCurrentProcessId();
+			for (auto& h : e.holders) {
+				if (h.count > 0 && h.process == self) {
+					h.count--;
+					return;
+				}
+			}
+		}
+
+		class Lock {
+		public:
+			Lock() {
+				// 別のプロセスがロックを持ったまま落ちた
+				if (WaitForSingleObject(mutex, INFINITE) == WAIT_ABANDONED) {
+					reapDead();
+				}
+			}
+			~Lock() {
+				ReleaseMutex(mutex);
+			}
+		};
+
+		uint64 hashDocument(const FilePath& doc) {
+			std::wstring s = FileSystem::FullPath(doc).str();
+			uint64 h = 14695981039346656037ull;
+			for (wchar_t c : s) {
+				if (c == L'\\') c = L'/';
+				h ^= static_cast<uint64>(std::towlower(c));
+				h *= 1099511628211ull;
+			}
+			return h;
+		}
+
+		int32 find(uint64 doc, int32 page, const Size& size) {
+			Entry* e = entries();
+			for (uint32 i = 0; i < numEntries; i++) {
+				if (e[i].state != EntryState::Empty && e[i].document == doc && e[i].page == page && e[i].width == size.x && e[i].height == size.y) {
+					return static_cast<int32>(i);
+				}
+			}
+			return -1;
+		}
+
+		void release(Entry& e) {
+			for (uint32 b = 0; b < e.numBlocks; b++) blockOwner()[e.firstBlock + b] = -1;
+			e.state = EntryState::Empty;
+			header()->evictions++;
+		}
+
+		// 参照されていない中で一番長く使われていないものを捨てる。捨てられなければ false
+		bool evictOne() {
+			Entry* e = entries();
+			int32 oldest = -1;
+			for (uint32 i = 0; i < numEntries; i++) {
+				if (e[i].state != EntryState::Ready || isReferenced(e[i])) continue;
+				if (oldest < 0 || e[i].lastUsed < e[oldest].lastUsed) oldest = static_cast<int32>(i);
+			}
+			if (oldest < 0) return false;
+			release(e[oldest]);
+			return true;
+		}
+
+		// 連続した n ブロックの先頭。なければ -1
+		int32 findRun(uint32 n) {
+			const int32* owner = blockOwner();
+			uint32 run = 0;
+			for (uint32 b = 0; b < header()->numBlocks; b++) {
+				run = owner[b] < 0 ? run + 1 : 0;
+				if (run == n) return static_cast<int32>(b + 1 - n);
+			}
+			return -1;
+		}
+	}
+
+	// 全体で bytes の共有キャッシュを開く。すでに別のプロセスが作っていればそれにつなぐ(大きさは作ったプロセスの設定になる)
+	bool open(uint64 bytes) {
+		if (isOpen()) return true;
+		mutex = CreateMutexW(nullptr, FALSE, mutexName);
+		if (!mutex) return false;
+		const uint32 numBlocks = static_cast<uint32>(bytes / blockBytes);
+		const uint64 total = detail::dataOffset(numBlocks) + numBlocks * blockBytes;
+		mapping = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+			static_cast<DWORD>(total >> 32), static_cast<DWORD>(total), mappingName);
+		if (!mapping) {
+			CloseHandle(mutex);
+			mutex = nullptr;
+			return false;
+		}
+		const bool created = GetLastError() != ERROR_ALREADY_EXISTS;
+		view = static_cast<uint8*>(MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0));
+		if (!view) {
+			CloseHandle(mapping);
+			CloseHandle(mutex);
+			mapping = mutex = nullptr;
+			return false;
+		}
+
+		// ブロック数は自分の設定ではなく、実際にマップされた大きさから決める
+		MEMORY_BASIC_INFORMATION info;
+		uint32 mapped = 0;
+		if (VirtualQuery(view, &info, sizeof(info)) && detail::dataOffset(0) <= info.RegionSize) {
+			mapped = static_cast<uint32>(info.RegionSize / blockBytes);
+			while (mapped > 0 && detail::dataOffset(mapped) + mapped * blockBytes > info.RegionSize) mapped--;
+		}
+		if (mapped == 0) {
+			UnmapViewOfFile(view);
+			CloseHandle(mapping);
+			CloseHandle(mutex);
+			view = nullptr;
+			mapping = mutex = nullptr;
+			return false;
+		}
+
+		detail::Lock lock;
+		if (detail::header()->magic != magic) {
+			// 作ったプロセスより先に別のプロセスがロックを取ることもあるので、作ったかどうかではなく magic で見て、
+			// 最初にロックを取ったプロセスが表を初期化する
+			std::memset(view, 0, static_cast<size_t>(detail::dataOffset(mapped)));
+			detail::header()->numBlocks = mapped;
+			for (uint32 b = 0; b < mapped; b++) detail::blockOwner()[b] = -1;
+			detail::header()->magic = magic;
+		}
+		Log << L"sharedcache: " << (created ? L"created " : L"attached ")
+			<< (detail::header()->numBlocks * blockBytes >> 20) << L"MB";
+		return true;
+	}
+
+	void close() {
+		if (view) UnmapViewOfFile(view);
+		if (mapping) CloseHandle(mapping);
+		if (mutex) CloseHandle(mutex);
+		view = nullptr;
+		mapping = mutex = nullptr;
+	}
+
+	// 背景スレッドから呼ぶ。大きさ size のものがあれば image に取り出して true
+	bool get(const FilePath& doc, int32 page, const Size& size, Image& image) {
+		if (!isOpen()) return false;
+		using namespace detail;
+		const uint64 key = hashDocument(doc);
+		Entry* e = nullptr;
+		{
+			Lock lock;
+			const int32 i = find(key, page, size);
+			if (i < 0 || entries()[i].state != EntryState::Ready || !hold(entries()[i])) {
+				header()->misses++;
+				numMisses++;
+				return false;
+			}
+			e = &entries()[i];
+			e->lastUsed = ++header()->clock;
+			header()->hits++;
+		}
+		// 参照を持っている間は捨てられないので、コピーはロックの外で
+		image = Image(e->width, e->height);
+		std::memcpy(image.data(), blockData(e->firstBlock), static_cast<size_t>(e->width) * e->height * sizeof(Color));
+		{
+			Lock lock;
+			unhold(*e);
+		}
+		numHits++;
+		return true;
+	}
+
+	// 背景スレッドから呼ぶ。image の大きさをキーにする。入りきらない(参照中のものばかりで空けられない)ときは何もしない
+	void put(const FilePath& doc, int32 page, const Image& image) {
+		if (!isOpen() || !image) return;
+		using namespace detail;
+		const uint64 key = hashDocument(doc);
+		const uint64 bytes = static_cast<uint64>(image.width) * image.height * sizeof(Color);
+		const uint32 n = static_cast<uint32>((bytes + blockBytes - 1) / blockBytes);
+		Entry* e = nullptr;
+		{
+			Lock lock;
+			if (n > header()->numBlocks || find(key, page, image.size) >= 0) return;
+			// 空けられないときは、落ちたプロセスの参照が残っていないか見てからもう一度試す
+			bool reaped = false;
+			int32 first;
+			while ((first = findRun(n)) < 0) {
+				if (evictOne()) continue;
+				if (reaped) return;
+				reapDead();
+				reaped = true;
+			}
+			int32 slot = -1;
+			for (uint32 i = 0; i < numEntries && slot < 0; i++) {
+				if (entries()[i].state == EntryState::Empty) slot = static_cast<int32>(i);
+			}
+			while (slot < 0) {
+				if (!evictOne()) {
+					if (reaped) return;
+					reapDead();
+					reaped = true;
+					continue;
+				}
+				for (uint32 i = 0; i < numEntries && slot < 0; i++) {
+					if (entries()[i].state == EntryState::Empty) slot = static_cast<int32>(i);
+				}
+			}
+			e = &entries()[slot];
+			e->document = key;
+			e->page = page;
+			e->width = image.width;
+			e->height = image.height;
+			e->state = EntryState::Writing;
+			e->writer = GetCurrentProcessId();
+			std::memset(e->holders, 0, sizeof(e->holders));
+			e->firstBlock = static_cast<uint32>(first);
+			e->numBlocks = n;
+			e->lastUsed = ++header()->clock;
+			for (uint32 b = 0; b < n; b++) blockOwner()[first + b] = slot;
+		}
+		std::memcpy(blockData(e->firstBlock), image.data(), static_cast<size_t>(bytes));
+		{
+			Lock lock;
+			e->state = EntryState::Ready;
+		}
+	}
+
+	String describe() {
+		if (!isOpen()) return L"shared cache off";
+		detail::Lock lock;
+		uint32 used = 0;
+		for (uint32 b = 0; b < detail::header()->numBlocks; b++) {
+			if (detail::blockOwner()[b] >= 0) used++;
+		}
+		return Format(L"shared ", used * blockBytes >> 20, L"/", detail::header()->numBlocks * blockBytes >> 20,
+			L"MB / hits ", numHits.load(), L" / misses ", numMisses.load());
+	}
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <Siv3D.hpp>
+
+// 起動の段階ごとの所要時間を測ってログに出す
+// ウィンドウは先に出して操作できるようにし、書棚の走査や表紙のデコードは背景で進める。
+// 段階は phase() で区切り、最初のフレーム・書棚の完成など一度だけの節目は milestone() で記録する。
+namespace startup
+{
+	Stopwatch clock;
+	int64 lastUs = 0;
+	Array<String> reached;
+
+	void begin() {
+		clock.restart();
+		lastUs = 0;
+		reached.clear();
+	}
+
+	// 前の phase() からここまでを name の段階として記録する
+	void phase(const String& name) {
+		const int64 now = clock.us();
+		Log << L"startup: " << name << L" " << (now - lastUs) / 1000.0 << L"ms (total " << now / 1000.0 << L"ms)";
+		lastUs = now;
+	}
+
+	// 起動してから name に着くまでの時間を1回だけ記録する
+	void milestone(const String& name) {
+		if (std::find(reached.begin(), reached.end(), name) != reached.end()) return;
+		reached.push_back(name);
+		Log << L"startup: " << name << L" at " << clock.us() / 1000.0 << L"ms";
+	}
+}
@@ -0,0 +1,128 @@
+#pragma once
+#include <ppltasks.h>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <Siv3D.hpp>
+
+// 全書籍で共有するサムネイルのキャッシュ
+// 一度作ったサムネイルは各書籍の thumbs/ に保存し、次からは小さい画像を読むだけで済ませる。
+// GPUに置く枚数には全体で上限(budget)があり、最近使っていないものから捨てる。
+namespace thumbnail
+{
+	int32 height = 64;
+	int32 coverHeight = 256; // 書棚に並べる表紙
+	size_t budget = 4000;
+	int32 maxInFlight = 8; // 同時にデコードする枚数
+	int32 maxUploadsPerFrame = 32;
+
+	Texture nullThumbnail;
+
+	FilePath thumbnailPath(const FilePath& bookDir, int page) {
+		return Format(L"{}thumbs/page-{:03d}.png"_fmt, bookDir, page + 1);
+	}
+
+	FilePath coverPath(const FilePath& bookDir) {
+		return Format(L"{}thumbs/cover.png"_fmt, bookDir);
+	}
+
+	// 背景スレッドで実行する。保存済みのサムネイルがなければ元画像から作って保存する
+	Image makeThumbnail(const FilePath& source, const FilePath& cache, int32 height = thumbnail::height) {
+		if (FileSystem::Exists(cache)) {
+			return Image(cache);
+		}
+		Image image(source);
+		if (!image) {
+			return image;
+		}
+		const int32 w = std::max(1, image.width * height / std::max(1, image.height));
+		Image small = image.scaled(w, height);
+		FileSystem::CreateDirectories(FileSystem::ParentPath(cache));
+		small.save(cache);
+		return small;
+	}
+
+	namespace detail
+	{
+		struct Entry {
+			Texture texture;
+			uint64 lastUsed = 0;
+			std::list<std::wstring>::iterator lru;
+		};
+		struct Pending {
+			std::shared_ptr<Image> image;
+			concurrency::task<void> task;
+		};
+
+		std::unordered_map<std::wstring, Entry> entries;
+		std::list<std::wstring> lru; // 先頭が最近使ったもの
+		std::unordered_map<std::wstring, Pending> pending;
+		uint64 frame = 0;
+		uint32 numDecoded = 0;
+		uint32 numEvicted = 0;
+
+		// キャッシュにあればそのTextureを、なければデコードを始めて空のTextureを返す
+		const Texture& request(const std::wstring& key, const FilePath& source, const FilePath& cache, int32 h) {
+			auto found = entries.find(key);
+			if (found != entries.end()) {
+				found->second.lastUsed = frame;
+				lru.splice(lru.begin(), lru, found->second.lru);
+				return found->second.texture;
+			}
+			if (pending.find(key) == pending.end() && static_cast<int32>(pending.size()) < maxInFlight) {
+				auto image = std::make_shared<Image>();
+				Pending p;
+				p.image = image;
+				p.task = concurrency::create_task([image, source, cache, h]() {
+					*image = makeThumbnail(source, cache, h);
+				});
+				pending[key] = p;
+			}
+			return nullThumbnail;
+		}
+	}
+
+	// 毎フレーム呼ぶ。書き上がったサムネイルのTexture化と、上限を超えた分の破棄をする
+	void update() {
+		using namespace detail;
+		frame++;
+		int32 n = 0;
+		for (auto it = pending.begin(); it != pending.end() && n < maxUploadsPerFrame;) {
+			if (!it->second.task.is_done()) {
+				++it;
+				continue;
+			}
+			lru.push_front(it->first);
+			Entry& e = entries[it->first];
+			e.texture = Texture(*it->second.image);
+			e.lastUsed = frame;
+			e.lru = lru.begin();
+			numDecoded++;
+			n++;
+			it = pending.erase(it);
+		}
+		while (entries.size() > budget && !lru.empty()) {
+			auto found = entries.find(lru.back());
+			if (found->second.lastUsed + 1 >= frame) break; // 画面に出ているものは捨てない
+			entries.erase(found);
+			lru.pop_back();
+			numEvicted++;
+		}
+	}
+
+	// 書籍 bookDir の page 枚目のサムネイル。まだなければデコードを始めて空のTextureを返す
+	const Texture& get(const FilePath& bookDir, int page) {
+		const FilePath source = Format(L"{}page-{:03d}.png"_fmt, bookDir, page + 1);
+		return detail::request(source.str(), source, thumbnailPath(bookDir, page), height);
+	}
+
+	// 書籍の表紙(source は cover.png か1ページ目)。ページのサムネイルより大きく作って thumbs/cover.png に保存する
+	const Texture& getCover(const FilePath& bookDir, const FilePath& source) {
+		return detail::request(source.str() + L"#cover", source, coverPath(bookDir), coverHeight);
+	}
+
+	size_t numCached() {
+		return detail::entries.size();
+	}
+}
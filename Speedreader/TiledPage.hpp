@@ -0,0 +1,266 @@
+#pragma once
+#include <ppl.h>
+#include <ppltasks.h>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <Siv3D.hpp>
+#include "AtomicFile.hpp"
+
+// 拡大表示用のタイル分割ページ
+// ページを解像度の段(level)ごとに固定サイズのタイルに分け、<doc>/tiles/ にPNGで書いておく。
+// 拡大表示では画面に入るタイルのファイルだけを背景で読んでTextureにするので、原寸のページをメモリに持たない。
+// タイルがまだなければ、最初に拡大したときに1度だけ原寸でデコードして書き出す(--ingest で書いておくこともできる)。
+// 細かいタイルが揃うまでは、loader が持っているページ全体のTextureを下敷きに描く。
+namespace zoom
+{
+	const int32 tileSize = 256;
+	s3d::PyFmtString tileFmt = L"{}tiles/page-{:03d}/{}-{}-{}.png"_fmt;
+	s3d::PyFmtString levelsFmt = L"{}tiles/page-{:03d}/levels.txt"_fmt;
+
+	// 各段の大きさ。level 0 が原寸、level k は 1/2^k。タイルを全部書き終えてから作るファイルなので、あればタイルは揃っている
+	Array<Size> readLevels(const FilePath& doc, int page) {
+		Array<Size> levels;
+		TextReader reader(Format(levelsFmt, doc, page + 1));
+		if (!reader) return levels;
+		String line;
+		while (reader.readLine(line)) {
+			const auto wh = line.split(L' ');
+			if (wh.size() < 2) break;
+			levels.emplace_back(Parse<int32>(wh[0]), Parse<int32>(wh[1]));
+		}
+		return levels;
+	}
+
+	// ページのタイルをすべて書き出す。段を1つずつ作って書くので、同時に持つのは原寸と次の段だけ。
+	// cancel が立ったら途中でやめる(段の大きさは書かないので、次に開いたときに作り直す)
+	bool writeTiles(Image image, const FilePath& doc, int page, const std::atomic<bool>* cancel = nullptr) {
+		FileSystem::CreateDirectories(FileSystem::ParentPath(Format(levelsFmt, doc, page + 1)));
+		Array<Size> levels;
+		for (int32 level = 0; ; level++) {
+			const int32 nx = (image.width + tileSize - 1) / tileSize;
+			const int32 ny = (image.height + tileSize - 1) / tileSize;
+			std::atomic<bool> ok{ true };
+			concurrency::parallel_for(0, nx * ny, [&](int32 k) {
+				if (!ok || (cancel && *cancel)) return;
+				const int32 x = (k % nx) * tileSize, y = (k / nx) * tileSize;
+				const Image tile = image.clipped(x, y, std::min(tileSize, image.width - x), std::min(tileSize, image.height - y));
+				if (!atomicfile::save(tile, Format(tileFmt, doc, page + 1, level, k % nx, k / nx))) {
+					ok = false;
+				}
+			});
+			if (!ok || (cancel && *cancel)) return false;
+			levels.push_back(image.size);
+			if (image.width <= tileSize && image.height <= tileSize) break;
+			image = image.scaled(std::max(1, image.width / 2), std::max(1, image.height / 2));
+		}
+		return atomicfile::write(Format(levelsFmt, doc, page + 1), [&levels](const FilePath& tmp) {
+			TextWriter writer(tmp);
+			if (!writer) return false;
+			for (const auto& s : levels) {
+				writer.writeln(s.x, L" ", s.y);
+			}
+			return true;
+		});
+	}
+
+	class TiledPage {
+	public:
+		size_t maxTiles = 96; // GPUに置くタイルの上限
+		int32 maxUploadsPerFrame = 4; // 1フレームで作るTextureの上限。60fpsを守るため少なめにする
+		size_t maxLoadsInFlight = 8;  // 背景で同時に読むタイルの上限
+
+		~TiledPage() {
+			cancelBuild();
+		}
+
+		// 表示するページを切り替える。同じページなら何もしない。
+		// タイルがなければ decode で原寸のページを得て書き出す。decode は背景スレッドで呼ばれる
+		void open(const FilePath& doc, int page, std::function<Image()> decode) {
+			if (doc == currentDoc && page == currentPage) {
+				return;
+			}
+			cancelBuild();
+			currentDoc = doc;
+			currentPage = page;
+			decodeSource = decode;
+			tiles.clear();
+			loads.clear();
+			levels = readLevels(doc, page);
+			needsBuild = levels.empty();
+		}
+
+		bool isReady() const {
+			return !levels.empty();
+		}
+
+		// pageRect はページ全体を画面に置いたときの矩形(画面からはみ出してよい)
+		void update(const RectF& pageRect, const RectF& viewport) {
+			frame++;
+			if (!isReady()) {
+				build();
+				return;
+			}
+			level = chooseLevel(pageRect);
+			// 読み終わったタイルをTextureにする
+			int32 uploads = 0;
+			for (auto it = loads.begin(); it != loads.end() && uploads < maxUploadsPerFrame;) {
+				if (!it->second.task.is_done()) {
+					++it;
+					continue;
+				}
+				// 読めなかったタイルも空のまま置いておき、毎フレーム読み直さないようにする
+				Tile tile;
+				if (*it->second.image) {
+					tile.texture = Texture(*it->second.image);
+					uploads++;
+				}
+				tile.lastUsed = frame;
+				tiles[it->first] = tile;
+				it = loads.erase(it);
+			}
+			// 画面に入るタイルでまだないものを読みに行く
+			forEachVisibleTile(pageRect, viewport, [&](int32 tx, int32 ty, const RectF&) {
+				const uint64 k = key(level, tx, ty);
+				auto it = tiles.find(k);
+				if (it != tiles.end()) {
+					it->second.lastUsed = frame;
+					return;
+				}
+				if (loads.count(k) || loads.size() >= maxLoadsInFlight) {
+					return;
+				}
+				auto image = std::make_shared<Image>();
+				const FilePath path = Format(tileFmt, currentDoc, currentPage + 1, level, tx, ty);
+				loads[k] = Load{ image, concurrency::create_task([image, path]() { *image = Image(path); }) };
+			});
+			evict();
+		}
+
+		void draw(const TextureRegion& coarse, const RectF& pageRect, const RectF& viewport) const {
+			coarse.resize(pageRect.w, pageRect.h).draw(pageRect.x, pageRect.y);
+			if (!isReady()) {
+				return;
+			}
+			forEachVisibleTile(pageRect, viewport, [&](int32 tx, int32 ty, const RectF& r) {
+				auto it = tiles.find(key(level, tx, ty));
+				if (it != tiles.end() && it->second.texture) {
+					it->second.texture.resize(r.w, r.h).draw(r.x, r.y);
+				}
+			});
+		}
+
+		size_t numTiles() const {
+			return tiles.size();
+		}
+
+		int32 currentLevel() const {
+			return level;
+		}
+
+	private:
+		struct Tile {
+			Texture texture;
+			uint64 lastUsed = 0;
+		};
+
+		struct Load {
+			std::shared_ptr<Image> image;
+			concurrency::task<void> task;
+		};
+
+		FilePath currentDoc;
+		int currentPage = -1;
+		std::function<Image()> decodeSource;
+		Array<Size> levels;
+		bool needsBuild = false;
+		concurrency::task<bool> buildTask;
+		bool building = false;
+		std::shared_ptr<std::atomic<bool>> buildCancel;
+		std::unordered_map<uint64, Tile> tiles;
+		std::unordered_map<uint64, Load> loads; // 読み込み中のタイル。ページを替えたら結果は捨てる
+		uint64 frame = 0;
+		int32 level = 0;
+
+		static uint64 key(int32 level, int32 tx, int32 ty) {
+			return (static_cast<uint64>(level) << 48) | (static_cast<uint64>(tx) << 24) | static_cast<uint64>(ty);
+		}
+
+		void cancelBuild() {
+			if (buildCancel) *buildCancel = true;
+		}
+
+		// タイルを書き出す。原寸のページは1枚で百MBを超えることがあるので、書き出しは同時に1つだけにする。
+		// 前のページの書き出しが残っていれば、取り消してそれが止まるのを待ってから始める
+		void build() {
+			if (building) {
+				if (!buildTask.is_done()) return;
+				building = false;
+				if (buildTask.get() && !*buildCancel) {
+					levels = readLevels(currentDoc, currentPage);
+				}
+			}
+			if (!needsBuild || !levels.empty()) return;
+			needsBuild = false;
+			auto cancel = std::make_shared<std::atomic<bool>>(false);
+			buildCancel = cancel;
+			const FilePath doc = currentDoc;
+			const int page = currentPage;
+			auto decode = decodeSource;
+			buildTask = concurrency::create_task([cancel, doc, page, decode]() {
+				if (*cancel) return false;
+				Image image = decode();
+				if (!image || *cancel) return false;
+				const bool ok = writeTiles(std::move(image), doc, page, cancel.get());
+				if (!ok && !*cancel) Log << L"zoom: failed to write tiles for page " << (page + 1);
+				return ok;
+			});
+			building = true;
+		}
+
+		// 画面上の1ピクセルに対して1ピクセル以上ある一番粗い段を選ぶ
+		int32 chooseLevel(const RectF& pageRect) const {
+			const double screenPerSource = pageRect.w / levels[0].x;
+			int32 l = 0;
+			while (l + 1 < static_cast<int32>(levels.size()) && screenPerSource * (2 << l) <= 1.0) {
+				l++;
+			}
+			return l;
+		}
+
+		template <class Fun>
+		void forEachVisibleTile(const RectF& pageRect, const RectF& viewport, Fun f) const {
+			const Size size = levels[level];
+			const double sx = pageRect.w / size.x, sy = pageRect.h / size.y;
+			const int32 nx = (size.x + tileSize - 1) / tileSize;
+			const int32 ny = (size.y + tileSize - 1) / tileSize;
+			const int32 x0 = std::max(0, static_cast<int32>((viewport.x - pageRect.x) / sx) / tileSize);
+			const int32 y0 = std::max(0, static_cast<int32>((viewport.y - pageRect.y) / sy) / tileSize);
+			const int32 x1 = std::min(nx - 1, static_cast<int32>((viewport.x + viewport.w - pageRect.x) / sx) / tileSize);
+			const int32 y1 = std::min(ny - 1, static_cast<int32>((viewport.y + viewport.h - pageRect.y) / sy) / tileSize);
+			for (int32 ty = y0; ty <= y1; ty++) {
+				for (int32 tx = x0; tx <= x1; tx++) {
+					const int32 w = std::min(tileSize, size.x - tx * tileSize);
+					const int32 h = std::min(tileSize, size.y - ty * tileSize);
+					f(tx, ty, RectF(pageRect.x + tx * tileSize * sx, pageRect.y + ty * tileSize * sy, w * sx, h * sy));
+				}
+			}
+		}
+
+		// このフレームで使わなかったタイルを古い順に捨てる
+		void evict() {
+			while (tiles.size() > maxTiles) {
+				auto oldest = tiles.end();
+				for (auto it = tiles.begin(); it != tiles.end(); ++it) {
+					if (it->second.lastUsed == frame) continue;
+					if (oldest == tiles.end() || it->second.lastUsed < oldest->second.lastUsed) {
+						oldest = it;
+					}
+				}
+				if (oldest == tiles.end()) break;
+				tiles.erase(oldest);
+			}
+		}
+	};
+}